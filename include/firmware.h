@@ -0,0 +1,111 @@
+#include <STM32FreeRTOS.h>
+#include <U8g2lib.h>
+#include <atomic>
+#include <can_proto>
+#include <cstdint>
+#include <filter>
+#include <knob>
+#include <midi>
+#include <ring>
+#include <sequencer>
+#include <synth>
+#include <tables>
+#include <ui>
+
+#ifndef FIRMWARE_H
+#define FIRMWARE_H
+
+// Config values
+const uint32_t displayInterval = 50;	 // Display update interval in ms, must divide 1000
+const uint32_t samplingRate = 48000; // Sampling rate, step sizes are generated from this at compile time
+constexpr double referenceA4 = 440.0; // Tuning reference in Hz
+const uint32_t blockSize = 220;		 // Samples per audio buffer, 4.58ms at 48kHz
+const bool stereoOutput = true;		 // Pan voices across OUTL_PIN and OUTR_PIN, false plays one mix on both
+const uint32_t canBaseID = 0x100;	 // Each board sends with this ID or its node ID, so no two boards' frames share an ID
+const uint32_t canFilterMask = 0x700; // Receives every board's frames, including 0x123 from older firmware
+const uint8_t envelopeSettings = 16; // Positions of each envelope knob
+const uint8_t filterCutoffs = 44;	 // Filter cutoff knob positions, 80Hz up to 11.5kHz in steps of a sixth of an octave
+const uint8_t filterResonances = 16; // Filter resonance knob positions, Q from 0.71 up to 11 in steps of 1.2x
+constexpr double vibratoRate = 5.5; // Joystick vibrato rate in Hz
+const uint32_t loadReportInterval = 100; // ms between cluster load reports, boards are dropped after 3 missed reports
+const uint32_t midiBaudRate = 115200; // For a serial to MIDI bridge on the virtual COM port, 31250 for a MIDI interface
+const uint8_t midiChannel = 0;		  // Channel 1, for sent notes, received messages are played on any channel
+const uint8_t midiNoteOffset = 23;	  // MIDI note number of note 0, so C1 is 24 and A4 is 69
+const uint8_t midiVelocity = 100;	  // Velocity of sent notes, as the keys are not velocity sensitive
+const uint8_t sequencerTempos = 52;	  // Tempo knob positions, from lowestTempo BPM in steps of tempoStep
+const uint32_t lowestTempo = 40;
+const uint32_t tempoStep = 5;
+const uint8_t clockInterval = 4;	  // Sequencer steps between clock messages, one per beat
+const uint8_t fmDepths = 16;		  // FM depth knob positions, modulation index from 0 in steps of fmDepthStep
+const int32_t fmDepthStep = 128;	  // Half a radian, in Q8
+const uint8_t fmFeedbacks = 8;		  // FM feedback knob positions, from 0 in steps of fmFeedbackStep
+const int32_t fmFeedbackStep = 51;	  // A fifth of a radian, in Q8
+const uint32_t idleHoldoff = 250;	  // ms of silence after the last release before the sample timer is parked
+
+// Synthesis parameters, gathered from the knobs by scanKeysTask() and read whole by renderTask() once per block
+struct Controls {
+	int32_t gain; // Output gain, Q24 from the signed 16-bit mix to the 8-bit DAC
+	uint8_t waveform;
+	int32_t attack, decay, sustain, release; // As for Synth::setEnvelope()
+	uint8_t filterType, filterCutoff, filterResonance; // Knob positions, looked up in the filter tables
+	uint8_t sequencerMode;
+	uint32_t tempo; // BPM
+	uint8_t gate;
+	uint8_t operators;
+	int32_t fmDepth, fmFeedback; // As for Synth::setFM()
+};
+
+// Globals defined in main.cpp, shared with the native host programs
+extern std::atomic<bool> isMainSynth;
+extern std::atomic<uint8_t> keyArray[7];
+extern std::atomic<uint8_t> octave;
+extern std::atomic<uint8_t> selectedWaveform;
+extern std::atomic<int> latestKey;
+extern std::atomic<int8_t> volume;
+extern std::atomic<bool> volumeFiner;
+extern QueueHandle_t msgInQ;
+extern SPSCRing<CANFrame, 32> rxRing;
+extern BusStats busStats;
+extern KeysDecoder keysDecoder;
+extern std::atomic<bool> activeNotes[numNotes];
+extern std::atomic<bool> bufferReady;
+extern std::atomic<uint32_t> underrunCount;
+extern std::atomic<bool> audioParked;
+extern std::atomic<uint32_t> parkCount;
+extern std::atomic<uint32_t> parkedTime;
+extern std::atomic<uint32_t> parkedSince;
+extern Knob K0, K1, K2, K3;
+extern Knob KA, KD, KS, KR;
+extern Knob KT, KC, KQ;
+extern Knob KM, KB, KG;
+extern Knob KO, KI, KF;
+extern Synth synth;
+extern Filter filter;
+extern Sequencer sequencer;
+extern Seqlock<Controls> controls;
+extern U8G2_SSD1305_128X32_NONAME_F_HW_I2C u8g2;
+extern DisplayUI ui;
+
+// Functions defined in main.cpp
+void setup();
+void DAC_DMA_ISR(uint32_t half);
+void renderNextBlock();
+void renderPending();
+void audioWake();
+void decodeMessage(const uint8_t RX_Message[8]);
+void decodePending();
+void decodeMidiMessage(const MidiMessage &message);
+bool transmitNextMessage(const TickType_t wait);
+void keysChangedSendTXMessage(uint8_t octave, uint16_t state, uint16_t changed);
+void announceMainSynth();
+int32_t volumeStep(bool finer);
+int32_t volumeGain(int8_t volume, bool finer);
+void publishControls();
+
+#ifdef ENABLE_BENCH
+// Functions defined in bench.cpp
+uint32_t runBenchmarks(uint32_t hostSpeedup);
+void benchTask(void *pvParameters);
+#endif
+
+#endif
@@ -0,0 +1,60 @@
+#include <adpcm>
+
+// IMA-ADPCM quantiser step sizes, and the change in step index for each code
+static const int16_t stepTable[89] = {
+	7, 8, 9, 10, 11, 12, 13, 14, 16, 17, 19, 21, 23, 25, 28, 31, 34, 37, 41, 45, 50, 55, 60, 66, 73, 80, 88, 97, 107, 118,
+	130, 143, 157, 173, 190, 209, 230, 253, 279, 307, 337, 371, 408, 449, 494, 544, 598, 658, 724, 796, 876, 963, 1060,
+	1166, 1282, 1411, 1552, 1707, 1878, 2066, 2272, 2499, 2749, 3024, 3327, 3660, 4026, 4428, 4871, 5358, 5894, 6484,
+	7132, 7845, 8630, 9493, 10442, 11487, 12635, 13899, 15289, 16818, 18500, 20350, 22385, 24623, 27086, 29794, 32767};
+static const int8_t indexTable[16] = {-1, -1, -1, -1, 2, 4, 6, 8, -1, -1, -1, -1, 2, 4, 6, 8};
+
+void AdpcmVoice::start(const AdpcmSample *newSample) {
+	sample = newSample;
+	position = 0;
+	predictor = 0;
+	index = 0;
+	fraction = 0;
+	decode(carry, 2, true);
+}
+
+void AdpcmVoice::decode(int16_t *out, uint32_t count, bool loop) {
+	const uint8_t *data = sample->data;
+	while (count) {
+		const bool looping = loop && sample->loopEnd;
+		const uint32_t end = looping ? sample->loopEnd : sample->length;
+		if (position >= end) {
+			if (!looping) { // Finished, the envelope fades the voice out
+				for (uint32_t i = 0; i < count; i++)
+					out[i] = 0;
+				return;
+			}
+			position = sample->loopStart;
+			predictor = sample->loopPredictor;
+			index = sample->loopIndex;
+		}
+		// Decode up to the loop end or the end of the sample without checking for either
+		uint32_t run = end - position < count ? end - position : count;
+		int32_t value = predictor;
+		uint32_t stepIndex = index;
+		for (uint32_t i = 0; i < run; i++, position++) {
+			const uint8_t code = (data[position >> 1] >> ((position & 1) << 2)) & 0xF;
+			const int32_t step = stepTable[stepIndex];
+			int32_t difference = step >> 3;
+			if (code & 4)
+				difference += step;
+			if (code & 2)
+				difference += step >> 1;
+			if (code & 1)
+				difference += step >> 2;
+			value += (code & 8) ? -difference : difference;
+			value = value > 32767 ? 32767 : value < -32768 ? -32768 : value;
+			int32_t nextIndex = (int32_t)stepIndex + indexTable[code];
+			stepIndex = nextIndex < 0 ? 0 : nextIndex > 88 ? 88 : nextIndex;
+			out[i] = value;
+		}
+		predictor = value;
+		index = stepIndex;
+		out += run;
+		count -= run;
+	}
+}
@@ -0,0 +1,151 @@
+#include <can_proto>
+
+void encodeKeysMessage(uint8_t message[8], uint8_t octave, uint16_t state, uint16_t changed, uint8_t sequence,
+					   uint8_t sender) {
+	message[0] = MSG_KEYS;
+	message[1] = octave;
+	message[2] = state & 0xFF;
+	message[3] = (state >> 8) & 0x0F;
+	message[4] = changed & 0xFF;
+	message[5] = (changed >> 8) & 0x0F;
+	message[6] = sequence;
+	message[7] = sender;
+}
+
+KeysEncoder::KeysEncoder() {
+	for (uint8_t i = 0; i < keysOctaves; i++) {
+		nextSequence[i] = 0;
+		unsent[i] = 0;
+	}
+}
+
+void KeysEncoder::encode(uint8_t message[8], uint8_t octave, uint16_t state, uint16_t changed, uint8_t sender) {
+	if (octave >= keysOctaves) { // Other octaves are not tracked
+		encodeKeysMessage(message, octave, state, changed, 0, sender);
+		return;
+	}
+	encodeKeysMessage(message, octave, state, changed | unsent[octave], nextSequence[octave]++, sender);
+	unsent[octave] = 0;
+}
+
+void KeysEncoder::dropped(const uint8_t message[8]) {
+	uint8_t octave = message[1];
+	if (octave >= keysOctaves)
+		return;
+	unsent[octave] |= message[4] | ((message[5] & 0x0F) << 8);
+	nextSequence[octave] = message[6];
+}
+
+uint16_t KeysEncoder::getUnsent(uint8_t octave) const {
+	return octave < keysOctaves ? unsent[octave] : 0;
+}
+
+MainElection::MainElection() : mainNode(0), mainTime(0) {}
+
+bool MainElection::announce(uint8_t node, uint32_t time) {
+	if (mainNode && node > mainNode && time - mainTime < raceWindow)
+		return false;
+	mainNode = node;
+	mainTime = time;
+	return true;
+}
+
+KeysDecoder::KeysDecoder() {
+	KeysDecoder::resyncCount = 0;
+	KeysDecoder::decoded = 0;
+	for (Sender &sender : senders)
+		sender.used = false;
+}
+
+// Returns the tracking of a sender, starting it unsynced in a free slot or the one heard from longest ago if it is new
+KeysDecoder::Sender &KeysDecoder::findSender(uint8_t node) {
+	Sender *oldest = &senders[0];
+	for (Sender &sender : senders) {
+		if (sender.used && sender.node == node)
+			return sender;
+		if (!sender.used || (oldest->used && (int32_t)(sender.lastHeard - oldest->lastHeard) < 0))
+			oldest = &sender;
+	}
+	oldest->node = node;
+	oldest->used = true;
+	for (uint8_t i = 0; i < numOctaves; i++) {
+		oldest->state[i] = 0;
+		oldest->nextSequence[i] = 0;
+		oldest->synced[i] = false;
+	}
+	return *oldest;
+}
+
+uint16_t KeysDecoder::decode(const uint8_t message[8], uint8_t &octave, uint16_t &pressed) {
+	octave = message[1];
+	pressed = message[2] | ((message[3] & 0x0F) << 8);
+	if (octave >= numOctaves)
+		return 0;
+	Sender &sender = findSender(message[7]);
+	sender.lastHeard = decoded++;
+	uint16_t changed = message[4] | ((message[5] & 0x0F) << 8);
+	if (sender.synced[octave] && message[6] != sender.nextSequence[octave]) { // Lost messages, catch up from the state
+		changed |= pressed ^ sender.state[octave];
+		resyncCount++;
+	}
+	sender.synced[octave] = true;
+	sender.nextSequence[octave] = message[6] + 1;
+	sender.state[octave] = pressed;
+	return changed;
+}
+
+uint8_t KeysDecoder::getNextSequence(uint8_t node, uint8_t octave) {
+	if (octave >= numOctaves)
+		return 0;
+	for (Sender &sender : senders) {
+		if (sender.used && sender.node == node)
+			return sender.nextSequence[octave];
+	}
+	return 0;
+}
+
+// CRC-15 of one bit, polynomial 0x4599
+static inline uint16_t crc15(uint16_t crc, uint8_t bit) {
+	bool invert = bit ^ ((crc >> 14) & 1);
+	crc = (crc << 1) & 0x7FFF;
+	return invert ? crc ^ 0x4599 : crc;
+}
+
+uint32_t canFrameBits(uint32_t ID, const uint8_t *data, uint8_t length) {
+	// Stuffed fields: SOF, 11-bit ID, RTR, IDE, r0, 4-bit DLC, data, 15-bit CRC
+	uint8_t bits[1 + 11 + 3 + 4 + 64 + 15];
+	uint32_t count = 0;
+	bits[count++] = 0;
+	for (int8_t i = 10; i >= 0; i--)
+		bits[count++] = (ID >> i) & 1;
+	bits[count++] = 0;
+	bits[count++] = 0;
+	bits[count++] = 0;
+	for (int8_t i = 3; i >= 0; i--)
+		bits[count++] = (length >> i) & 1;
+	for (uint8_t i = 0; i < length; i++)
+		for (int8_t j = 7; j >= 0; j--)
+			bits[count++] = (data[i] >> j) & 1;
+	uint16_t crc = 0;
+	for (uint32_t i = 0; i < count; i++)
+		crc = crc15(crc, bits[i]);
+	for (int8_t i = 14; i >= 0; i--)
+		bits[count++] = (crc >> i) & 1;
+	// A stuff bit is inserted after 5 equal bits, and counts towards the next run
+	uint32_t stuffBits = 0, run = 1;
+	uint8_t previous = bits[0];
+	for (uint32_t i = 1; i < count; i++) {
+		if (bits[i] == previous) {
+			if (++run == 5) {
+				stuffBits++;
+				previous = !previous;
+				run = 1;
+			}
+		} else {
+			previous = bits[i];
+			run = 1;
+		}
+	}
+	// Unstuffed: CRC delimiter, ACK slot and delimiter, 7-bit EOF, 3-bit interframe space
+	return count + stuffBits + 13;
+}
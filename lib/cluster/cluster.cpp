@@ -0,0 +1,111 @@
+#include <cluster>
+
+VoiceScheduler::VoiceScheduler(uint8_t localCapacity, uint32_t timeout) {
+	VoiceScheduler::timeout = timeout;
+	VoiceScheduler::failovers = 0;
+	nodeID[0] = noNode;
+	capacity[0] = localCapacity;
+	reported[0] = 0;
+	lastReport[0] = 0;
+	reset();
+}
+
+void VoiceScheduler::setLocalID(uint8_t localID) {
+	nodeID[0] = localID;
+}
+
+void VoiceScheduler::reset() {
+	nodeCount = 1;
+	held[0] = 0;
+	for (uint8_t i = 0; i < numNotes; i++)
+		noteNode[i] = 0;
+}
+
+void VoiceScheduler::report(uint8_t node, uint8_t voices, uint8_t nodeCapacity, uint32_t now) {
+	if (node == noNode || node == nodeID[0] || !nodeCapacity)
+		return;
+	uint8_t index = 1;
+	while (index < nodeCount && nodeID[index] != node)
+		index++;
+	if (index == nodeCount) {
+		if (nodeCount == maxNodes)
+			return;
+		nodeCount++;
+		nodeID[index] = node;
+		held[index] = 0;
+	}
+	capacity[index] = nodeCapacity;
+	reported[index] = voices;
+	lastReport[index] = now;
+}
+
+uint8_t VoiceScheduler::noteOn(uint8_t note, uint8_t localVoices) {
+	if (note >= numNotes)
+		return nodeID[0];
+	if (noteNode[note]) // Retrigger on the board already playing it
+		return nodeID[noteNode[note] - 1];
+	reported[0] = localVoices;
+	uint8_t best = 0;
+	uint32_t bestLoad = 0, bestCapacity = 1;
+	for (uint8_t i = 0; i < nodeCount; i++) {
+		uint32_t load = reported[i] > held[i] ? reported[i] : held[i];
+		// Compare load / capacity without dividing, the first node wins ties so this board is preferred
+		if (i == 0 || load * bestCapacity < bestLoad * capacity[i]) {
+			best = i;
+			bestLoad = load;
+			bestCapacity = capacity[i];
+		}
+	}
+	held[best]++;
+	noteNode[note] = best + 1;
+	return nodeID[best];
+}
+
+uint8_t VoiceScheduler::noteOff(uint8_t note) {
+	if (note >= numNotes || !noteNode[note])
+		return noNode;
+	uint8_t index = noteNode[note] - 1;
+	noteNode[note] = 0;
+	if (held[index])
+		held[index]--;
+	return nodeID[index];
+}
+
+// Swap the last node into the removed slot, moving its notes with it
+void VoiceScheduler::removeNode(uint8_t index) {
+	uint8_t last = --nodeCount;
+	for (uint8_t i = 0; i < numNotes; i++) {
+		if (noteNode[i] == last + 1)
+			noteNode[i] = index + 1;
+	}
+	nodeID[index] = nodeID[last];
+	capacity[index] = capacity[last];
+	reported[index] = reported[last];
+	held[index] = held[last];
+	lastReport[index] = lastReport[last];
+}
+
+uint8_t VoiceScheduler::expire(uint32_t now, uint8_t notes[numNotes]) {
+	uint8_t count = 0;
+	for (uint8_t i = nodeCount - 1; i > 0; i--) {
+		if (now - lastReport[i] <= timeout)
+			continue;
+		for (uint8_t n = 0; n < numNotes; n++) {
+			if (noteNode[n] == i + 1) {
+				noteNode[n] = 0;
+				notes[count++] = n;
+			}
+		}
+		removeNode(i);
+		failovers++;
+	}
+	return count;
+}
+
+uint8_t VoiceScheduler::getNodeCount() {
+	return nodeCount;
+}
+
+uint32_t VoiceScheduler::getFailovers() {
+	return failovers;
+}
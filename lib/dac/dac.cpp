@@ -0,0 +1,90 @@
+#ifndef NATIVE_BUILD
+
+#include <dac>
+#include <stm32l4xx_hal.h>
+
+// Overwrite the weak default IRQ Handler
+extern "C" void DMA1_Channel3_IRQHandler(void);
+
+// Pointer to user ISR
+static void (*DAC_DMA_ISR)(uint32_t half) = nullptr;
+static uint32_t bufferLength = 0;
+
+// Registers are written directly, as the Arduino core already defines HAL_DAC_MspInit() and HAL_TIM_Base_MspInit()
+uint32_t DAC_Init(uint32_t rate, uint16_t *buffer, uint32_t length, void (&callback)(uint32_t half)) {
+	DAC_DMA_ISR = &callback;
+	bufferLength = length;
+
+	__HAL_RCC_GPIOA_CLK_ENABLE();
+	__HAL_RCC_DAC1_CLK_ENABLE();
+	__HAL_RCC_TIM6_CLK_ENABLE();
+	__HAL_RCC_DMA1_CLK_ENABLE();
+
+	GPIO_InitTypeDef GPIO_InitDAC = {
+		GPIO_PIN_4 | GPIO_PIN_5, // PA4 is DAC1_OUT1 (OUTR_PIN), PA5 is DAC1_OUT2 (OUTL_PIN)
+		GPIO_MODE_ANALOG,		 // Analog output
+		GPIO_NOPULL,			 // No pull-up
+		GPIO_SPEED_FREQ_LOW,	 // Unused for analog pins
+		0						 // No alternate function
+	};
+	HAL_GPIO_Init(GPIOA, &GPIO_InitDAC);
+
+	// TIM6 counts at the 80MHz timer clock and sends TRGO on every update
+	TIM6->CR1 = 0;
+	TIM6->PSC = 0;
+	TIM6->ARR = (SystemCoreClock + rate / 2) / rate - 1;
+	TIM6->CR2 = TIM_CR2_MMS_1; // MMS = 010, update event as TRGO
+	TIM6->EGR = TIM_EGR_UG;
+
+	// Both channels are triggered by TIM6 TRGO (TSEL = 000), channel 1 requests the DMA transfer to DHR8RD
+	DAC1->CR = 0;
+	DAC1->CR = DAC_CR_TEN1 | DAC_CR_DMAEN1 | DAC_CR_TEN2;
+	DAC1->CR |= DAC_CR_EN1 | DAC_CR_EN2;
+
+	// DMA1 channel 3 request 6 is DAC channel 1, copying one halfword per trigger and wrapping at the end
+	DMA1_Channel3->CCR = 0;
+	DMA1_CSELR->CSELR = (DMA1_CSELR->CSELR & ~DMA_CSELR_C3S) | (6 << DMA_CSELR_C3S_Pos);
+	DMA1_Channel3->CPAR = (uint32_t)&DAC1->DHR8RD;
+	DMA1_Channel3->CMAR = (uint32_t)buffer;
+	DMA1_Channel3->CNDTR = length;
+	DMA1_Channel3->CCR = DMA_CCR_DIR | DMA_CCR_CIRC | DMA_CCR_MINC | DMA_CCR_PSIZE_0 | DMA_CCR_MSIZE_0 |
+						 DMA_CCR_PL_1 | DMA_CCR_HTIE | DMA_CCR_TCIE;
+	DMA1_Channel3->CCR |= DMA_CCR_EN;
+
+	HAL_NVIC_SetPriority(DMA1_Channel3_IRQn, 5, 0); // Above CAN, within FreeRTOS's syscall priorities
+	HAL_NVIC_EnableIRQ(DMA1_Channel3_IRQn);
+	return 0;
+}
+
+// The DMA is rewound while disabled, clearing any half transfer flag left from before the stop
+uint32_t DAC_Start() {
+	DMA1_Channel3->CCR &= ~DMA_CCR_EN;
+	DMA1->IFCR = DMA_IFCR_CGIF3;
+	DMA1_Channel3->CNDTR = bufferLength;
+	DMA1_Channel3->CCR |= DMA_CCR_EN;
+	TIM6->CNT = 0;
+	TIM6->CR1 |= TIM_CR1_CEN;
+	return 0;
+}
+
+uint32_t DAC_Stop() {
+	TIM6->CR1 &= ~TIM_CR1_CEN;
+	return 0;
+}
+
+// Half transfer means the first half has been played, transfer complete means the second has
+void DMA1_Channel3_IRQHandler() {
+	uint32_t flags = DMA1->ISR;
+	if (flags & DMA_ISR_HTIF3) {
+		DMA1->IFCR = DMA_IFCR_CHTIF3;
+		if (DAC_DMA_ISR)
+			DAC_DMA_ISR(0);
+	}
+	if (flags & DMA_ISR_TCIF3) {
+		DMA1->IFCR = DMA_IFCR_CTCIF3;
+		if (DAC_DMA_ISR)
+			DAC_DMA_ISR(1);
+	}
+}
+
+#endif
@@ -0,0 +1,51 @@
+#ifdef NATIVE_BUILD
+
+#include <Arduino.h>
+#include <dac>
+
+static uint16_t *dmaBuffer = nullptr;
+static uint32_t dmaLength = 0;
+static uint32_t dmaIndex = 0;
+static void (*dmaCallback)(uint32_t half) = nullptr;
+static bool running = false;
+static uint16_t held = 128 | 128 << 8; // Last sample played, reset to the midpoint like the DAC
+
+uint32_t DAC_Init(uint32_t rate, uint16_t *buffer, uint32_t length, void (&callback)(uint32_t half)) {
+	dmaBuffer = buffer;
+	dmaLength = length;
+	dmaIndex = 0;
+	dmaCallback = &callback;
+	return 0;
+}
+
+uint32_t DAC_Start() {
+	dmaIndex = 0;
+	running = true;
+	return 0;
+}
+
+uint32_t DAC_Stop() {
+	running = false;
+	return 0;
+}
+
+namespace native {
+void dacTick() {
+	if (running && dmaBuffer)
+		held = dmaBuffer[dmaIndex++];
+	if (analogWriteHook) {
+		analogWriteHook(A3, held & 0xFF);
+		analogWriteHook(A4, held >> 8);
+	}
+	if (!running)
+		return;
+	if (dmaIndex == dmaLength / 2) {
+		dmaCallback(0);
+	} else if (dmaIndex == dmaLength) {
+		dmaIndex = 0;
+		dmaCallback(1);
+	}
+}
+} // namespace native
+
+#endif
@@ -1,3 +1,5 @@
+#ifndef NATIVE_BUILD
+
 #include <es_can>
 #include <stm32l4xx_hal_can.h>
 #include <stm32l4xx_hal_cortex.h>
@@ -200,3 +202,5 @@ void CAN1_TX_IRQHandler(void) {
 	// Use the HAL interrupt handler
 	HAL_CAN_IRQHandler(&CAN_Handle);
 }
+
+#endif
@@ -0,0 +1,226 @@
+#ifdef NATIVE_BUILD
+
+#include <Arduino.h>
+#include <can_proto>
+#include <cstring>
+#include <es_can>
+
+// Host model of a CAN bus of up to native::canMaxNodes bxCAN peripherals, each with a 3 message receive FIFO,
+// 3 transmit mailboxes and one ID/mask filter. Calls to the es_can API act on the node chosen with
+// native::canSelectNode(), node 0 by default, so a single firmware instance needs no changes
+// Frames are sent by native::canRunBus() at 125kbit/s with bit stuffing, the lowest ID winning arbitration.
+// A node in loopback mode only receives its own frames, other nodes only receive frames from the rest of the bus
+
+static const uint32_t rxFifoDepth = 3;
+static const uint32_t txMailboxes = 3;
+static const uint64_t bitNanos = 1000000000ULL / canBitRate;
+
+struct Frame {
+	uint32_t ID;
+	uint8_t data[8];
+	uint64_t queuedNanos;
+};
+
+struct Node {
+	bool loopbackMode;
+	bool started;
+	uint32_t filterID, filterMask;
+	uint32_t rxFifoID[rxFifoDepth];
+	uint8_t rxFifoData[rxFifoDepth][8];
+	uint32_t rxFifoHead, rxFifoLevel;
+	Frame mailbox[txMailboxes]; // Oldest first, sent in request order as TransmitFifoPriority is enabled
+	uint32_t mailboxLevel;
+	void (*rxISR)();
+	void (*txISR)();
+};
+
+static Node nodes[native::canMaxNodes];
+static uint32_t nodeCount = 1;
+static uint32_t currentNode = 0;
+static native::CanBusStats busStats;
+static bool transmitting = false;
+static uint32_t transmitter = 0;
+static uint64_t transmitEnd = 0;
+static uint64_t busFree = 0;
+
+namespace native {
+void canSetNodes(uint32_t count) {
+	nodeCount = count < 1 ? 1 : count > canMaxNodes ? canMaxNodes : count;
+}
+
+void canSelectNode(uint32_t node) {
+	if (node < nodeCount)
+		currentNode = node;
+}
+
+uint32_t canSelectedNode() {
+	return currentNode;
+}
+
+CanBusStats canBusStats() {
+	return busStats;
+}
+} // namespace native
+
+// Runs ISRs as the given node, so the es_can calls they make act on it
+static void runISR(void (*isr)(), uint32_t node) {
+	if (!isr)
+		return;
+	uint32_t previous = currentNode;
+	currentNode = node;
+	isr();
+	currentNode = previous;
+}
+
+static void receive(uint32_t node, const Frame &frame) {
+	Node &n = nodes[node];
+	if (((frame.ID ^ n.filterID) & n.filterMask) != 0)
+		return;
+	if (n.rxFifoLevel == rxFifoDepth) { // Overrun frames are discarded, as in the hardware FIFO
+		busStats.rxOverruns++;
+		return;
+	}
+	uint32_t tail = (n.rxFifoHead + n.rxFifoLevel) % rxFifoDepth;
+	n.rxFifoID[tail] = frame.ID;
+	memcpy(n.rxFifoData[tail], frame.data, 8);
+	n.rxFifoLevel++;
+	runISR(n.rxISR, node);
+}
+
+// Lower IDs win arbitration, then identical IDs are compared through the data as the bits go out
+static bool beats(const Frame &a, const Frame &b) {
+	if (a.ID != b.ID)
+		return a.ID < b.ID;
+	return memcmp(a.data, b.data, 8) < 0;
+}
+
+// Delivers the frame being transmitted, removing it from its mailbox once another node has acknowledged it
+static void completeTransmission() {
+	transmitting = false;
+	busFree = transmitEnd;
+	Node &sender = nodes[transmitter];
+	Frame frame = sender.mailbox[0];
+	bool acknowledged = sender.loopbackMode;
+	for (uint32_t i = 0; i < nodeCount; i++) {
+		if (i != transmitter && nodes[i].started && !nodes[i].loopbackMode)
+			acknowledged = true;
+	}
+	if (!acknowledged) { // The hardware retransmits until some node acknowledges the frame
+		busStats.ackErrors++;
+		return;
+	}
+	sender.mailboxLevel--;
+	memmove(sender.mailbox, sender.mailbox + 1, sender.mailboxLevel * sizeof(Frame));
+	busStats.framesSent++;
+	if (sender.loopbackMode) {
+		receive(transmitter, frame);
+	} else {
+		for (uint32_t i = 0; i < nodeCount; i++) {
+			if (i != transmitter && nodes[i].started && !nodes[i].loopbackMode)
+				receive(i, frame);
+		}
+	}
+	runISR(sender.txISR, transmitter);
+}
+
+namespace native {
+void canRunBus() {
+	uint64_t now = nanos();
+	while (true) {
+		if (transmitting) {
+			if (transmitEnd > now)
+				return;
+			completeTransmission();
+			continue;
+		}
+		// The bus starts the next frame as soon as it is free and a frame is waiting
+		uint64_t start = UINT64_MAX;
+		for (uint32_t i = 0; i < nodeCount; i++) {
+			if (nodes[i].started && nodes[i].mailboxLevel && nodes[i].mailbox[0].queuedNanos < start)
+				start = nodes[i].mailbox[0].queuedNanos;
+		}
+		if (start == UINT64_MAX)
+			return;
+		if (start < busFree)
+			start = busFree;
+		if (start > now)
+			return;
+		int32_t winner = -1;
+		uint32_t contenders = 0;
+		for (uint32_t i = 0; i < nodeCount; i++) {
+			if (!nodes[i].started || !nodes[i].mailboxLevel || nodes[i].mailbox[0].queuedNanos > start)
+				continue;
+			contenders++;
+			if (winner < 0 || beats(nodes[i].mailbox[0], nodes[winner].mailbox[0]))
+				winner = i;
+		}
+		for (uint32_t i = 0; i < nodeCount; i++) {
+			if (i != (uint32_t)winner && nodes[i].started && nodes[i].mailboxLevel &&
+				nodes[i].mailbox[0].queuedNanos <= start && nodes[i].mailbox[0].ID == nodes[winner].mailbox[0].ID)
+				busStats.sameIDContentions++;
+		}
+		if (contenders > 1)
+			busStats.arbitrations++;
+		const Frame &frame = nodes[winner].mailbox[0];
+		uint32_t bits = canFrameBits(frame.ID, frame.data, 8);
+		busStats.busyNanos += bits * bitNanos;
+		transmitter = winner;
+		transmitEnd = start + bits * bitNanos;
+		transmitting = true;
+	}
+}
+} // namespace native
+
+uint32_t CAN_Init(bool loopback) {
+	nodes[currentNode].loopbackMode = loopback;
+	return 0;
+}
+
+uint32_t setCANFilter(uint32_t newFilterID, uint32_t newMaskID, uint32_t filterBank) {
+	nodes[currentNode].filterID = newFilterID & 0x7ff;
+	nodes[currentNode].filterMask = newMaskID & 0x7ff;
+	return 0;
+}
+
+uint32_t CAN_Start() {
+	nodes[currentNode].started = true;
+	return 0;
+}
+
+uint32_t CAN_TX(uint32_t ID, uint8_t data[8]) {
+	Node &n = nodes[currentNode];
+	if (!n.started || n.mailboxLevel == txMailboxes)
+		return 1; // The hardware version would wait for a free mailbox
+	Frame &frame = n.mailbox[n.mailboxLevel++];
+	frame.ID = ID & 0x7ff;
+	memcpy(frame.data, data, 8);
+	frame.queuedNanos = native::nanos();
+	return 0;
+}
+
+uint32_t CAN_CheckRXLevel() {
+	return nodes[currentNode].rxFifoLevel;
+}
+
+uint32_t CAN_RX(uint32_t &ID, uint8_t data[8]) {
+	Node &n = nodes[currentNode];
+	if (!n.rxFifoLevel)
+		return 1; // The hardware version would wait forever
+	ID = n.rxFifoID[n.rxFifoHead];
+	memcpy(data, n.rxFifoData[n.rxFifoHead], 8);
+	n.rxFifoHead = (n.rxFifoHead + 1) % rxFifoDepth;
+	n.rxFifoLevel--;
+	return 0;
+}
+
+uint32_t CAN_RegisterRX_ISR(void (&callback)()) {
+	nodes[currentNode].rxISR = &callback;
+	return 0;
+}
+
+uint32_t CAN_RegisterTX_ISR(void (&callback)()) {
+	nodes[currentNode].txISR = &callback;
+	return 0;
+}
+
+#endif
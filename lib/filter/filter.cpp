@@ -0,0 +1,127 @@
+#include <cmath>
+#include <filter>
+
+#ifdef __ARM_FEATURE_DSP
+#include <Arduino.h> // CMSIS intrinsics
+
+// Low half of low with the low half of high in the top half
+static inline uint32_t pack(int32_t low, uint32_t high) {
+	return __PKHBT(low, high, 16);
+}
+
+// Adds the products of the low halves and of the high halves, as signed 16-bit values, to acc
+static inline int64_t multiplyAccumulate(uint32_t a, uint32_t b, int64_t acc) {
+	return __SMLALD(a, b, (uint64_t)acc);
+}
+
+static inline int32_t saturate16(int32_t value) {
+	return __SSAT(value, 16);
+}
+#else
+static inline uint32_t pack(int32_t low, uint32_t high) {
+	return (low & 0xFFFF) | high << 16;
+}
+
+static inline int64_t multiplyAccumulate(uint32_t a, uint32_t b, int64_t acc) {
+	acc += (int16_t)a * (int16_t)b; // Each product is added separately, their sum can overflow 32 bits
+	return acc + (int16_t)(a >> 16) * (int16_t)(b >> 16);
+}
+
+static inline int32_t saturate16(int32_t value) {
+	return value > 32767 ? 32767 : value < -32768 ? -32768 : value;
+}
+#endif
+
+// Fraction bits that fit the largest of a set of coefficients into 16 bits, at least 14
+static uint8_t fractionBits(float largest) {
+	uint8_t bits = 14;
+	while (bits < 30 && ldexpf(largest, bits + 1) < 32767)
+		bits++;
+	return bits;
+}
+
+// Rounds a coefficient scaled by 2^bits into 16 bits
+static int32_t quantise(float value, uint8_t bits) {
+	int32_t scaled = lroundf(ldexpf(value, bits));
+	return scaled > 32767 ? 32767 : scaled < -32768 ? -32768 : scaled;
+}
+
+Filter::Filter() {
+	type = FILTER_OFF;
+	b0 = b12 = a12 = 0;
+	bBits = aBits = 14;
+	reset();
+}
+
+void Filter::setCoefficients(FilterType newType, int32_t cosW, int32_t sinW, int32_t q) {
+	if (newType != type)
+		reset();
+	type = newType;
+	float cosine = ldexpf(cosW, -30);
+	float oneMinusCos = ldexpf((1 << 30) - cosW, -30); // Exact, as the difference is small at low cutoffs
+	float quality = ldexpf(q, -16);
+	float alpha = ldexpf(sinW, -30) / (2 * quality);
+	float gain = (type != FILTER_BANDPASS && quality > 1) ? 1 / sqrtf(quality) : 1;
+	float a0 = 1 + alpha;
+	float b[3];
+	switch (type) {
+	case FILTER_LOWPASS:
+		b[0] = b[2] = oneMinusCos / 2;
+		b[1] = oneMinusCos;
+		break;
+	case FILTER_HIGHPASS:
+		b[0] = b[2] = (1 + cosine) / 2;
+		b[1] = -(1 + cosine);
+		break;
+	case FILTER_BANDPASS: // 0dB gain at the cutoff
+		b[0] = alpha;
+		b[1] = 0;
+		b[2] = -alpha;
+		break;
+	default:
+		return;
+	}
+	float largest = 0;
+	for (uint8_t i = 0; i < 3; i++) {
+		b[i] *= gain / a0;
+		largest = fmaxf(largest, fabsf(b[i]));
+	}
+	bBits = fractionBits(largest);
+	b0 = quantise(b[0], bBits);
+	b12 = pack(quantise(b[1], bBits), quantise(b[2], bBits));
+	float a1 = -2 * (oneMinusCos + alpha) / a0; // -a1 - 2, without subtracting nearly equal values
+	float a2 = 2 * alpha / a0;							 // 1 - a2
+	aBits = fractionBits(fmaxf(fabsf(a1), a2));
+	a12 = pack(quantise(a1, aBits), quantise(a2, aBits));
+}
+
+FilterType Filter::getType() {
+	return type;
+}
+
+void Filter::process(int32_t *block, uint32_t length, uint8_t channel) {
+	if (type == FILTER_OFF)
+		return;
+	uint32_t x = x12[channel], y = y12[channel], error = dropped[channel];
+	const uint8_t shift = bBits > aBits ? bBits : aBits; // Both sums are aligned to the finer of the two
+	const uint8_t bAlign = shift - bBits, aAlign = shift - aBits;
+	for (uint32_t i = 0; i < length; i++) {
+		int64_t feedforward = multiplyAccumulate(x, b12, block[i] * b0);
+		int64_t feedback = (int64_t)(2 * (int16_t)y - (int16_t)(y >> 16)) << aBits; // 2 y1 - y2
+		feedback = multiplyAccumulate(y, a12, feedback);
+		int64_t sum = (feedforward << bAlign) + (feedback << aAlign) + error;
+		int32_t out = saturate16(sum >> shift);
+		error = sum & ((1 << shift) - 1);
+		x = pack(block[i], x);
+		y = pack(out, y);
+		block[i] = out;
+	}
+	x12[channel] = x;
+	y12[channel] = y;
+	dropped[channel] = error;
+}
+
+void Filter::reset() {
+	for (uint8_t i = 0; i < channels; i++)
+		x12[i] = y12[i] = dropped[i] = 0;
+}
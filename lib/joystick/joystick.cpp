@@ -0,0 +1,80 @@
+#include <joystick>
+#include <tables>
+
+const uint32_t bendRange = 2;					  // Semitones either way at full X deflection
+const int32_t deadZone = 2048;					  // Readings this close to the centre are ignored, about 3% of full scale
+const int32_t vibratoRange = 1920;				  // Q16 pitch deviation at full depth, 2^(0.5 / 12) - 1 or half a semitone
+const uint8_t smoothingShift = 3;				  // One-pole smoothing by 1/8 per control period, 37ms at 218Hz
+const uint32_t bendSteps = 64;					  // Table intervals across the X axis
+constexpr Table<int32_t, bendSteps + 2> bendTable = makeBendTable<bendSteps + 1>(bendRange);
+constexpr Table<int16_t, 257> vibratoTable = makeSineTable<256>();
+
+JoystickControl::JoystickControl(uint32_t vibratoStep) {
+	JoystickControl::vibratoStep = vibratoStep;
+	vibratoPhase = 0;
+	modDepth = 0;
+	pitchFactor = unity;
+	midiBend = 0;
+	midiModulation = 0;
+	calibrate(32768, 32768);
+}
+
+void JoystickControl::calibrate(uint32_t x, uint32_t y) {
+	centreX = x;
+	centreY = y;
+	smoothX = x << 8;
+	smoothY = y << 8;
+}
+
+// Offset of a reading from the centre outside the dead zone, as Q16 from -1 to 1
+static int32_t deflection(int32_t smooth, int32_t centre) {
+	int32_t offset = (smooth >> 8) - centre;
+	int32_t range = (offset < 0 ? centre : 65535 - centre) - deadZone;
+	if (offset > deadZone) {
+		offset -= deadZone;
+	} else if (offset < -deadZone) {
+		offset += deadZone;
+	} else {
+		return 0;
+	}
+	if (range <= 0)
+		return 0;
+	int32_t position = ((int64_t)offset << 16) / range;
+	return position > 65536 ? 65536 : position < -65536 ? -65536 : position;
+}
+
+void JoystickControl::update(uint32_t x, uint32_t y) {
+	smoothX += ((int32_t)(x << 8) - smoothX) >> smoothingShift;
+	smoothY += ((int32_t)(y << 8) - smoothY) >> smoothingShift;
+
+	int32_t bendPosition = deflection(smoothX, centreX) + midiBend;
+	bendPosition = bendPosition > 65536 ? 65536 : bendPosition < -65536 ? -65536 : bendPosition;
+	uint32_t position = bendPosition + 65536; // 0 to 2 in Q16
+	uint32_t index = position >> 11;						   // 64 intervals over 2
+	int32_t fraction = position & 0x7FF;
+	int32_t bend = bendTable[index] + (((bendTable[index + 1] - bendTable[index]) * fraction) >> 11);
+
+	int32_t depth = deflection(smoothY, centreY);
+	modDepth = depth < 0 ? -depth : depth;
+	if (midiModulation > modDepth)
+		modDepth = midiModulation;
+	vibratoPhase += vibratoStep;
+	int32_t vibrato = ((vibratoTable[vibratoPhase >> 24] * (int64_t)modDepth >> 16) * vibratoRange) >> 15;
+	pitchFactor = ((int64_t)bend * (unity + vibrato)) >> 16;
+}
+
+int32_t JoystickControl::getPitchFactor() {
+	return pitchFactor;
+}
+
+int32_t JoystickControl::getModDepth() {
+	return modDepth;
+}
+
+void JoystickControl::setMidiBend(int32_t bend) {
+	midiBend = bend;
+}
+
+void JoystickControl::setMidiModulation(int32_t depth) {
+	midiModulation = depth;
+}
@@ -0,0 +1,95 @@
+#ifndef NATIVE_BUILD
+
+#include <joystick>
+#include <stm32l4xx_hal.h>
+
+// Readings per axis kept in the DMA buffer, each already 16x oversampled to 16 bits by the ADC
+static const uint32_t readingsPerAxis = 8;
+
+// Alternating Y (rank 1) and X (rank 2) readings, rewritten continuously by DMA1 channel 1
+static volatile uint16_t readings[readingsPerAxis * 2];
+
+static ADC_HandleTypeDef ADC_Handle;
+static DMA_HandleTypeDef DMA_Handle;
+
+// Clocks, pins and DMA are set up here rather than in HAL_ADC_MspInit(), which the Arduino core already defines
+uint32_t joystickInit() {
+	__HAL_RCC_GPIOA_CLK_ENABLE();
+	__HAL_RCC_ADC_CLK_ENABLE();
+	__HAL_RCC_DMA1_CLK_ENABLE();
+
+	GPIO_InitTypeDef GPIO_InitJoystick = {
+		GPIO_PIN_0 | GPIO_PIN_1,	   // PA0 is ADC1_IN5 (JOYY_PIN), PA1 is ADC1_IN6 (JOYX_PIN)
+		GPIO_MODE_ANALOG_ADC_CONTROL, // Analog, connected to the ADC
+		GPIO_NOPULL,				   // No pull-up
+		GPIO_SPEED_FREQ_LOW,		   // Unused for analog pins
+		0							   // No alternate function
+	};
+	HAL_GPIO_Init(GPIOA, &GPIO_InitJoystick);
+
+	DMA_Handle.Instance = DMA1_Channel1;
+	DMA_Handle.Init.Request = DMA_REQUEST_0; // ADC1
+	DMA_Handle.Init.Direction = DMA_PERIPH_TO_MEMORY;
+	DMA_Handle.Init.PeriphInc = DMA_PINC_DISABLE;
+	DMA_Handle.Init.MemInc = DMA_MINC_ENABLE;
+	DMA_Handle.Init.PeriphDataAlignment = DMA_PDATAALIGN_HALFWORD;
+	DMA_Handle.Init.MemDataAlignment = DMA_MDATAALIGN_HALFWORD;
+	DMA_Handle.Init.Mode = DMA_CIRCULAR; // Wraps to the start of readings forever
+	DMA_Handle.Init.Priority = DMA_PRIORITY_LOW;
+	if (HAL_DMA_Init(&DMA_Handle) != HAL_OK)
+		return 1;
+	__HAL_LINKDMA(&ADC_Handle, DMA_Handle, DMA_Handle);
+
+	ADC_Handle.Instance = ADC1;
+	ADC_Handle.Init.ClockPrescaler = ADC_CLOCK_SYNC_PCLK_DIV4; // 20MHz
+	ADC_Handle.Init.Resolution = ADC_RESOLUTION_12B;
+	ADC_Handle.Init.DataAlign = ADC_DATAALIGN_RIGHT;
+	ADC_Handle.Init.ScanConvMode = ADC_SCAN_ENABLE;
+	ADC_Handle.Init.EOCSelection = ADC_EOC_SEQ_CONV;
+	ADC_Handle.Init.LowPowerAutoWait = DISABLE;
+	ADC_Handle.Init.ContinuousConvMode = ENABLE;
+	ADC_Handle.Init.NbrOfConversion = 2;
+	ADC_Handle.Init.DiscontinuousConvMode = DISABLE;
+	ADC_Handle.Init.ExternalTrigConv = ADC_SOFTWARE_START;
+	ADC_Handle.Init.ExternalTrigConvEdge = ADC_EXTERNALTRIGCONVEDGE_NONE;
+	ADC_Handle.Init.DMAContinuousRequests = ENABLE; // Required for circular DMA
+	ADC_Handle.Init.Overrun = ADC_OVR_DATA_OVERWRITTEN;
+	ADC_Handle.Init.OversamplingMode = ENABLE; // Sum of 16 conversions, 16 bits
+	ADC_Handle.Init.Oversampling.Ratio = ADC_OVERSAMPLING_RATIO_16;
+	ADC_Handle.Init.Oversampling.RightBitShift = ADC_RIGHTBITSHIFT_NONE;
+	ADC_Handle.Init.Oversampling.TriggeredMode = ADC_TRIGGEREDMODE_SINGLE_TRIGGER;
+	ADC_Handle.Init.Oversampling.OversamplingStopReset = ADC_REGOVERSAMPLING_CONTINUED_MODE;
+	if (HAL_ADC_Init(&ADC_Handle) != HAL_OK)
+		return 1;
+
+	// The longest sampling time keeps the pair rate near 950Hz, well above the control rate but light on the bus
+	ADC_ChannelConfTypeDef channel = {};
+	channel.SamplingTime = ADC_SAMPLETIME_640CYCLES_5;
+	channel.SingleDiff = ADC_SINGLE_ENDED;
+	channel.OffsetNumber = ADC_OFFSET_NONE;
+	channel.Channel = ADC_CHANNEL_5;
+	channel.Rank = ADC_REGULAR_RANK_1;
+	if (HAL_ADC_ConfigChannel(&ADC_Handle, &channel) != HAL_OK)
+		return 1;
+	channel.Channel = ADC_CHANNEL_6;
+	channel.Rank = ADC_REGULAR_RANK_2;
+	if (HAL_ADC_ConfigChannel(&ADC_Handle, &channel) != HAL_OK)
+		return 1;
+
+	if (HAL_ADCEx_Calibration_Start(&ADC_Handle, ADC_SINGLE_ENDED) != HAL_OK)
+		return 1;
+	// DMA and ADC interrupts are left disabled in the NVIC, nothing needs to run per conversion
+	return HAL_ADC_Start_DMA(&ADC_Handle, (uint32_t *)readings, readingsPerAxis * 2) != HAL_OK;
+}
+
+void joystickRead(uint32_t &x, uint32_t &y) {
+	uint32_t sumX = 0, sumY = 0;
+	for (uint32_t i = 0; i < readingsPerAxis; i++) {
+		sumY += readings[2 * i];
+		sumX += readings[2 * i + 1];
+	}
+	x = sumX / readingsPerAxis;
+	y = sumY / readingsPerAxis;
+}
+
+#endif
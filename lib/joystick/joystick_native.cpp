@@ -0,0 +1,19 @@
+#ifdef NATIVE_BUILD
+
+#include <joystick>
+
+namespace native {
+uint32_t joystickX = 32768;
+uint32_t joystickY = 32768;
+} // namespace native
+
+uint32_t joystickInit() {
+	return 0;
+}
+
+void joystickRead(uint32_t &x, uint32_t &y) {
+	x = native::joystickX;
+	y = native::joystickY;
+}
+
+#endif
@@ -0,0 +1,21 @@
+#include <keyscan>
+
+KeyDebouncer::KeyDebouncer(uint32_t debounceMask) {
+	KeyDebouncer::state = 0;
+	KeyDebouncer::count0 = 0;
+	KeyDebouncer::count1 = 0;
+	KeyDebouncer::debounceMask = debounceMask;
+}
+
+uint32_t KeyDebouncer::getState() {
+	return state;
+}
+
+uint32_t KeyDebouncer::update(uint32_t sample) {
+	uint32_t delta = sample ^ state;
+	count1 = (count1 ^ count0) & delta; // Counters of keys that match their state are held at 0
+	count0 = ~count0 & delta;
+	uint32_t toggle = (delta & ~(count0 | count1) & debounceMask) | (delta & ~debounceMask);
+	state ^= toggle;
+	return toggle;
+}
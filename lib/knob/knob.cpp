@@ -3,11 +3,7 @@
 Knob::Knob(int minimum, int maximum, int initialRotation) {
 	Knob::minimum = minimum;
 	Knob::maximum = maximum;
-	Knob::A = false;
-	Knob::B = false;
-	Knob::previousRotation = NONE;
 	Knob::rotation = initialRotation;
-	Knob::rotationInternal = initialRotation;
 }
 
 int Knob::getRotation() {
@@ -16,76 +12,95 @@ int Knob::getRotation() {
 
 void Knob::setRotation(int newRotation) {
 	rotation = newRotation;
-	rotationInternal = newRotation;
 };
 
-void Knob::updateRotation(bool ANew, bool BNew) {
-	if (A == ANew && B == BNew)
-		return; // No change, do not update values
+void Knob::turn(int steps, uint8_t acceleration) {
+	if (!steps)
+		return;
+	if (maximum - minimum >= accelerationRange)
+		steps *= acceleration;
+	int newRotation = rotation + steps;
+	if (newRotation < minimum)
+		newRotation = minimum;
+	if (newRotation > maximum)
+		newRotation = maximum;
+	rotation = newRotation;
+}
 
-	bool fullstep = (BNew && ANew) || (!BNew && !ANew);
+void Knob::setLimits(int newMinimum, int newMaximum, int step, int newStep) {
+	if (newMinimum == minimum && newMaximum == maximum)
+		return;
+	int value = rotation * step;
+	int newRotation = (value + (value < 0 ? -newStep : newStep) / 2) / newStep; // Rounded half away from zero
+	if (newRotation < newMinimum)
+		newRotation = newMinimum;
+	if (newRotation > newMaximum)
+		newRotation = newMaximum;
+	rotation = newRotation;
+	minimum = newMinimum;
+	maximum = newMaximum;
+};
 
-	bool cwRot = (!B && !A && !BNew && ANew) ||
-				 (!B && A && BNew && ANew) ||
-				 (B && !A && !BNew && !ANew) ||
-				 (B && A && BNew && !ANew);
+// Transition from old state (BA) to new state, indexed by old * 4 + new
+// 1 is clockwise, -1 anticlockwise, 2 skipped a state
+static const int8_t transitions[16] = {
+	0, 1, -1, 2,  // From 00
+	-1, 0, 2, 1,  // From 01
+	1, 2, 0, -1,  // From 10
+	2, -1, 1, 0}; // From 11
 
-	bool acwRot = (!B && !A && BNew && !ANew) ||
-				  (!B && A && !BNew && !ANew) ||
-				  (B && !A && BNew && ANew) ||
-				  (B && A && !BNew && ANew);
+const uint32_t knobShift = 12;	  // First bit of the knob rows in the matrix
+const uint32_t fastDetent = 25;	  // ms between detents for 4x acceleration
+const uint32_t mediumDetent = 50; // ms between detents for 2x acceleration
 
-	bool impossible = (!B && !A && BNew && ANew) ||
-					  (!B && A && BNew && !ANew) ||
-					  (B && !A && !BNew && ANew) ||
-					  (B && A && !BNew && !ANew);
+KnobBank::KnobBank() {
+	state = 0;
+	for (uint8_t k = 0; k < numKnobs; k++) {
+		phase[k] = 0;
+		direction[k] = 0;
+		steps[k] = 0;
+		acceleration[k] = 1;
+		lastDetent[k] = 0;
+	}
+}
 
-	if (cwRot) {
-		if (previousRotation == CW && fullstep) {
-			rotationInternal++;
-		} else if (previousRotation == ACW && fullstep) {
-			previousRotation = NONE;
+void KnobBank::update(uint32_t matrix, uint32_t now) {
+	uint8_t newState = matrix >> knobShift;
+	uint8_t changed = newState ^ state;
+	if (!changed)
+		return;
+	for (uint8_t k = 0; k < numKnobs; k++) {
+		uint8_t shift = 2 * (numKnobs - 1 - k);
+		if (!((changed >> shift) & 0x3))
+			continue;
+		uint8_t from = (state >> shift) & 0x3, to = (newState >> shift) & 0x3;
+		int8_t transition = transitions[from << 2 | to];
+		if (transition == 2) {
+			phase[k] += 2 * direction[k];
 		} else {
-			previousRotation = CW;
+			phase[k] += transition;
+			direction[k] = transition;
 		}
-	} else if (acwRot) {
-		if (previousRotation == ACW && fullstep) {
-			rotationInternal--;
-		} else if (previousRotation == CW && fullstep) {
-			previousRotation = NONE;
-		} else {
-			previousRotation = ACW;
-		}
-	} else if (impossible) {
-		if (fullstep) {
-			switch (previousRotation) {
-				case NONE: // Step skipped and no previous direction
-					break;
-				case CW:
-					rotationInternal++;
-					break;
-				case ACW:
-					rotationInternal--;
-					break;
+		if (to == 0x0 || to == 0x3) { // Detent, reached after an even number of transitions
+			int detents = phase[k] / 2;
+			phase[k] = 0;
+			if (detents) {
+				uint32_t interval = now - lastDetent[k];
+				acceleration[k] = interval < fastDetent ? 4 : interval < mediumDetent ? 2 : 1;
+				lastDetent[k] = now;
+				steps[k] += detents;
 			}
 		}
 	}
-	A = ANew;
-	B = BNew;
-	if (rotationInternal < minimum)
-		rotationInternal = minimum;
-	if (rotationInternal > maximum)
-		rotationInternal = maximum;
-	rotation = rotationInternal;
+	state = newState;
 }
 
-void Knob::changeLimitsVolume(int newMinimum, int newMaximum) {
-	if (newMaximum > maximum) {
-		rotation = rotation << 1;
-	} else if (newMaximum < maximum) {
-		rotation = rotation >> 1;
-	} else {
-	}
-	minimum = newMinimum;
-	maximum = newMaximum;
-};
\ No newline at end of file
+int KnobBank::takeSteps(uint8_t knob) {
+	int taken = steps[knob];
+	steps[knob] = 0;
+	return taken;
+}
+
+uint8_t KnobBank::getAcceleration(uint8_t knob) {
+	return acceleration[knob];
+}
@@ -0,0 +1,32 @@
+#include <midi>
+
+// Data bytes in a channel message, by the top 4 bits of the status
+static uint8_t dataLength(uint8_t status) {
+	uint8_t type = status & 0xF0;
+	return (type == 0xC0 || type == 0xD0) ? 1 : 2; // Program change and channel pressure have one
+}
+
+MidiParser::MidiParser() {
+	status = 0;
+	count = 0;
+}
+
+bool MidiParser::parse(uint8_t byte, MidiMessage &message) {
+	if (byte >= 0xF8) // Real time, such as clock, may be sent in the middle of another message
+		return false;
+	if (byte & 0x80) {
+		status = byte < 0xF0 ? byte : 0; // System common and SysEx bytes are not channel messages
+		count = 0;
+		return false;
+	}
+	if (!status) // Data of a skipped message, or received before any status
+		return false;
+	data[count++] = byte;
+	if (count < dataLength(status))
+		return false;
+	message.status = status;
+	message.data1 = data[0];
+	message.data2 = count > 1 ? data[1] : 0;
+	count = 0;
+	return true;
+}
@@ -0,0 +1,59 @@
+#ifdef NATIVE_BUILD
+
+#include <cstring>
+#include <midi>
+
+static const uint32_t bufferSize = 256;
+
+static uint8_t rxBuffer[bufferSize];
+static uint32_t rxWrite = 0, rxRead = 0;
+static uint8_t txBuffer[bufferSize];
+static uint32_t txLength = 0;
+static void (*rxISR)() = nullptr;
+
+uint32_t MIDI_Init(uint32_t baudRate) {
+	rxWrite = rxRead = txLength = 0;
+	return 0;
+}
+
+uint32_t MIDI_RegisterRX_ISR(void (&callback)()) {
+	rxISR = &callback;
+	return 0;
+}
+
+// As in the hardware, bytes not collected before the buffer wraps are overwritten
+uint32_t midiReceive(uint8_t *bytes, uint32_t maximum) {
+	if (rxWrite - rxRead > bufferSize)
+		rxRead = rxWrite - bufferSize;
+	uint32_t count = 0;
+	while (rxRead != rxWrite && count < maximum)
+		bytes[count++] = rxBuffer[rxRead++ % bufferSize];
+	return count;
+}
+
+uint32_t midiSend(const uint8_t *bytes, uint32_t length) {
+	if (txLength + length > bufferSize)
+		return 1;
+	memcpy(txBuffer + txLength, bytes, length);
+	txLength += length;
+	return 0;
+}
+
+namespace native {
+void midiInject(const uint8_t *bytes, uint32_t length) {
+	for (uint32_t i = 0; i < length; i++)
+		rxBuffer[rxWrite++ % bufferSize] = bytes[i];
+	if (rxISR)
+		rxISR();
+}
+
+uint32_t midiTakeSent(uint8_t *bytes, uint32_t maximum) {
+	uint32_t count = txLength < maximum ? txLength : maximum;
+	memcpy(bytes, txBuffer, count);
+	memmove(txBuffer, txBuffer + count, txLength - count);
+	txLength -= count;
+	return count;
+}
+} // namespace native
+
+#endif
@@ -0,0 +1,149 @@
+#if defined(ENABLE_MIDI) && !defined(NATIVE_BUILD)
+
+#include <midi>
+#include <stm32l4xx_hal.h>
+
+// Overwrite the IRQ Handlers, the Arduino core leaves USART2_IRQHandler out with HAL_UART_MODULE_ONLY
+extern "C" void USART2_IRQHandler(void);
+extern "C" void DMA1_Channel6_IRQHandler(void);
+extern "C" void DMA1_Channel7_IRQHandler(void);
+
+static const uint32_t bufferSize = 256; // Half of the receive buffer is 40ms of bytes at 31250 baud, 11ms at 115200
+
+static uint8_t rxBuffer[bufferSize];
+static uint32_t rxRead = 0;
+static uint8_t txBuffer[bufferSize];
+static volatile uint32_t txHead = 0; // Bytes queued, only written by midiSend()
+static volatile uint32_t txTail = 0; // Bytes sent, only written by the DMA interrupt
+static volatile uint32_t txSending = 0;
+
+// Pointer to user ISR
+static void (*MIDI_RX_ISR)() = nullptr;
+
+// Registers are written directly, as for the DAC and ADC, the HAL driver would need its own IRQ handler too
+uint32_t MIDI_Init(uint32_t baudRate) {
+	__HAL_RCC_GPIOA_CLK_ENABLE();
+	__HAL_RCC_USART2_CLK_ENABLE();
+	__HAL_RCC_DMA1_CLK_ENABLE();
+
+	GPIO_InitTypeDef GPIO_InitTX = {
+		GPIO_PIN_2,				 // PA2 is USART2_TX
+		GPIO_MODE_AF_PP,		 // Alternate function, push-pull
+		GPIO_NOPULL,			 // No pull-up
+		GPIO_SPEED_FREQ_LOW,	 // Enough for 115200 baud
+		GPIO_AF7_USART2			 // Alternate function 7
+	};
+	HAL_GPIO_Init(GPIOA, &GPIO_InitTX);
+	GPIO_InitTypeDef GPIO_InitRX = {
+		GPIO_PIN_15,			 // PA15 is USART2_RX
+		GPIO_MODE_AF_PP,		 // Alternate function
+		GPIO_PULLUP,			 // Idle high when nothing is connected
+		GPIO_SPEED_FREQ_LOW,	 // Unused for inputs
+		GPIO_AF3_USART2			 // Alternate function 3
+	};
+	HAL_GPIO_Init(GPIOA, &GPIO_InitRX);
+
+	// 8 data bits, no parity, 1 stop bit, 16x oversampling, both directions by DMA
+	USART2->CR1 = 0;
+	USART2->BRR = (HAL_RCC_GetPCLK1Freq() + baudRate / 2) / baudRate;
+	USART2->CR3 = USART_CR3_DMAR | USART_CR3_DMAT;
+
+	// DMA1 channel 6 request 2 is USART2_RX, wrapping at the end of rxBuffer
+	DMA1_Channel6->CCR = 0;
+	DMA1_CSELR->CSELR = (DMA1_CSELR->CSELR & ~DMA_CSELR_C6S) | (2 << DMA_CSELR_C6S_Pos);
+	DMA1_Channel6->CPAR = (uint32_t)&USART2->RDR;
+	DMA1_Channel6->CMAR = (uint32_t)rxBuffer;
+	DMA1_Channel6->CNDTR = bufferSize;
+	DMA1_Channel6->CCR = DMA_CCR_CIRC | DMA_CCR_MINC | DMA_CCR_HTIE | DMA_CCR_TCIE;
+	DMA1_Channel6->CCR |= DMA_CCR_EN;
+
+	// DMA1 channel 7 request 2 is USART2_TX, started for each contiguous run of txBuffer
+	DMA1_Channel7->CCR = 0;
+	DMA1_CSELR->CSELR = (DMA1_CSELR->CSELR & ~DMA_CSELR_C7S) | (2 << DMA_CSELR_C7S_Pos);
+	DMA1_Channel7->CPAR = (uint32_t)&USART2->TDR;
+	DMA1_Channel7->CCR = DMA_CCR_DIR | DMA_CCR_MINC | DMA_CCR_TCIE;
+
+	USART2->CR1 = USART_CR1_IDLEIE | USART_CR1_TE | USART_CR1_RE | USART_CR1_UE;
+
+	HAL_NVIC_SetPriority(USART2_IRQn, 6, 0); // Below the DAC, within FreeRTOS's syscall priorities
+	HAL_NVIC_EnableIRQ(USART2_IRQn);
+	HAL_NVIC_SetPriority(DMA1_Channel6_IRQn, 6, 0);
+	HAL_NVIC_EnableIRQ(DMA1_Channel6_IRQn);
+	HAL_NVIC_SetPriority(DMA1_Channel7_IRQn, 6, 0);
+	HAL_NVIC_EnableIRQ(DMA1_Channel7_IRQn);
+	return 0;
+}
+
+uint32_t MIDI_RegisterRX_ISR(void (&callback)()) {
+	MIDI_RX_ISR = &callback;
+	return 0;
+}
+
+// DMA writes up to the byte before CNDTR counts back to the start
+uint32_t midiReceive(uint8_t *bytes, uint32_t maximum) {
+	uint32_t write = (bufferSize - DMA1_Channel6->CNDTR) % bufferSize;
+	uint32_t count = 0;
+	while (rxRead != write && count < maximum) {
+		bytes[count++] = rxBuffer[rxRead];
+		rxRead = (rxRead + 1) % bufferSize;
+	}
+	return count;
+}
+
+// Send the next contiguous run of queued bytes, if DMA is not already sending
+// Called from the DMA interrupt, or with it masked
+static void startTransmit() {
+	uint32_t pending = txHead - txTail;
+	if (txSending || !pending)
+		return;
+	uint32_t start = txTail % bufferSize;
+	uint32_t length = pending < bufferSize - start ? pending : bufferSize - start;
+	DMA1_Channel7->CCR &= ~DMA_CCR_EN;
+	DMA1_Channel7->CMAR = (uint32_t)(txBuffer + start);
+	DMA1_Channel7->CNDTR = length;
+	txSending = length;
+	DMA1_Channel7->CCR |= DMA_CCR_EN;
+}
+
+// Must only be called from one task, txTail can only move on while it runs, which leaves more room
+uint32_t midiSend(const uint8_t *bytes, uint32_t length) {
+	uint32_t head = txHead;
+	if (bufferSize - (head - txTail) < length)
+		return 1;
+	for (uint32_t i = 0; i < length; i++)
+		txBuffer[(head + i) % bufferSize] = bytes[i];
+	txHead = head + length;
+	HAL_NVIC_DisableIRQ(DMA1_Channel7_IRQn);
+	startTransmit();
+	HAL_NVIC_EnableIRQ(DMA1_Channel7_IRQn);
+	return 0;
+}
+
+// Idle line, one frame time without a start bit after the last byte of a burst
+void USART2_IRQHandler() {
+	if (USART2->ISR & USART_ISR_IDLE) {
+		USART2->ICR = USART_ICR_IDLECF;
+		if (MIDI_RX_ISR)
+			MIDI_RX_ISR();
+	}
+	if (USART2->ISR & USART_ISR_ORE) // Cannot happen while DMA keeps up, but would stop reception if left set
+		USART2->ICR = USART_ICR_ORECF;
+}
+
+// Half and full receive buffer, so a burst longer than half the buffer is collected before it is overwritten
+void DMA1_Channel6_IRQHandler() {
+	DMA1->IFCR = DMA_IFCR_CHTIF6 | DMA_IFCR_CTCIF6;
+	if (MIDI_RX_ISR)
+		MIDI_RX_ISR();
+}
+
+void DMA1_Channel7_IRQHandler() {
+	if (DMA1->ISR & DMA_ISR_TCIF7) {
+		DMA1->IFCR = DMA_IFCR_CTCIF7;
+		txTail = txTail + txSending;
+		txSending = 0;
+		startTransmit();
+	}
+}
+
+#endif
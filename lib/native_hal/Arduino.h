@@ -0,0 +1,117 @@
+// Host stand-in for the subset of the STM32 Arduino core used by the synth firmware
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+
+#ifndef ARDUINO_H
+#define ARDUINO_H
+
+#define LOW 0
+#define HIGH 1
+#define INPUT 0
+#define OUTPUT 1
+#define DEC 10
+#define HEX 16
+
+// Nucleo-L432KC pin names, numbered arbitrarily for the host
+enum {
+	D0 = 0, D1, D2, D3, D4, D5, D6, D7, D8, D9, D10, D11, D12, D13,
+	A0, A1, A2, A3, A4, A5, A6, A7,
+	LED_BUILTIN,
+	NUM_DIGITAL_PINS
+};
+
+// Each pin has its own port with the pin at bit 0, IDR follows native::setPin() and writes to BSRR are ignored
+struct GPIO_TypeDef {
+	volatile uint32_t IDR;
+	volatile uint32_t ODR;
+	volatile uint32_t BSRR;
+};
+GPIO_TypeDef *digitalPinToPort(uint32_t pin);
+uint32_t digitalPinToBitMask(uint32_t pin);
+
+void pinMode(uint32_t pin, uint32_t mode);
+void digitalWrite(uint32_t pin, uint32_t value);
+int digitalRead(uint32_t pin);
+void digitalToggle(uint32_t pin);
+void analogWrite(uint32_t pin, uint32_t value);
+uint32_t analogRead(uint32_t pin);
+
+uint32_t millis();
+uint32_t micros();
+void delay(uint32_t ms);
+void delayMicroseconds(uint32_t us);
+
+void noInterrupts();
+void interrupts();
+
+// 96-bit unique device ID, w0 is native::uid and the other words are 0
+uint32_t HAL_GetUIDw0();
+uint32_t HAL_GetUIDw1();
+uint32_t HAL_GetUIDw2();
+
+class Print {
+  public:
+	virtual size_t write(uint8_t c) = 0;
+	size_t write(const uint8_t *buffer, size_t size);
+	size_t print(const char *str);
+	size_t print(char c);
+	size_t print(unsigned char n, int base = DEC);
+	size_t print(int n, int base = DEC);
+	size_t print(unsigned int n, int base = DEC);
+	size_t print(long n, int base = DEC);
+	size_t print(unsigned long n, int base = DEC);
+	size_t println(const char *str = "");
+	size_t println(int n, int base = DEC);
+	size_t println(unsigned long n, int base = DEC);
+};
+
+// Serial writes to stdout, and never has any received bytes
+class HardwareSerial : public Print {
+  public:
+	void begin(unsigned long baud);
+	int available();
+	int read();
+	int availableForWrite();
+	size_t write(uint8_t c) override;
+	using Print::write;
+};
+extern HardwareSerial Serial;
+
+typedef enum {
+	TICK_FORMAT,
+	MICROSEC_FORMAT,
+	HERTZ_FORMAT
+} TimerFormat_t;
+
+struct TIM_TypeDef {
+	uint32_t id;
+};
+extern TIM_TypeDef *TIM1;
+
+// Timer callbacks are not called automatically, the host program drives the ISRs directly
+class HardwareTimer {
+  public:
+	HardwareTimer(TIM_TypeDef *instance);
+	void setOverflow(uint32_t overflow, TimerFormat_t format = TICK_FORMAT);
+	void attachInterrupt(void (*callback)());
+	void resume();
+	void pause();
+	bool isRunning();
+
+  private:
+	void (*callback)();
+	uint32_t overflow;
+	bool running;
+};
+
+// Host only controls, used by native programs to drive the stand-ins
+namespace native {
+extern void (*analogWriteHook)(uint32_t pin, uint32_t value);
+extern uint32_t uid;
+void setPin(uint32_t pin, bool value);
+void advanceNanos(uint64_t ns);
+uint64_t nanos();
+} // namespace native
+
+#endif
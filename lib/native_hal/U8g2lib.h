@@ -0,0 +1,33 @@
+// Host stand-in for the U8g2 display driver, drawing calls are accepted and discarded
+#include <Arduino.h>
+#include <cstdint>
+
+#ifndef U8G2LIB_H
+#define U8G2LIB_H
+
+#define U8G2_R0 0
+
+extern const uint8_t u8g2_font_profont12_mf[];
+
+class U8G2 : public Print {
+  public:
+	void begin() {}
+	void clearBuffer() {}
+	void sendBuffer() {}
+	void updateDisplayArea(int tx, int ty, int tw, int th) {}
+	void setFont(const uint8_t *font) {}
+	void setCursor(int x, int y) {}
+	void setDrawColor(int color) {}
+	void drawStr(int x, int y, const char *str) {}
+	void drawXBM(int x, int y, int w, int h, const uint8_t *bitmap) {}
+	void drawHLine(int x, int y, int w) {}
+	void drawBox(int x, int y, int w, int h) {}
+	size_t write(uint8_t c) override { return 1; }
+};
+
+class U8G2_SSD1305_128X32_NONAME_F_HW_I2C : public U8G2 {
+  public:
+	U8G2_SSD1305_128X32_NONAME_F_HW_I2C(int rotation) {}
+};
+
+#endif
@@ -0,0 +1,335 @@
+#include <Arduino.h>
+#include <STM32FreeRTOS.h>
+#include <U8g2lib.h>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <vector>
+
+#pragma region Arduino
+namespace native {
+void (*analogWriteHook)(uint32_t pin, uint32_t value) = nullptr;
+uint32_t uid = 0x00000001;
+static GPIO_TypeDef pinPorts[NUM_DIGITAL_PINS + 1]; // Last port is returned for invalid pins
+static bool pinInitialised = false;
+static uint64_t timeNanos = 0;
+
+// Inputs default to HIGH, as the key matrix is active low
+static void initialisePins() {
+	if (pinInitialised)
+		return;
+	for (uint32_t i = 0; i <= NUM_DIGITAL_PINS; i++)
+		pinPorts[i].IDR = 1;
+	pinInitialised = true;
+}
+
+void setPin(uint32_t pin, bool value) {
+	initialisePins();
+	if (pin < NUM_DIGITAL_PINS)
+		pinPorts[pin].IDR = value;
+}
+
+void advanceNanos(uint64_t ns) {
+	timeNanos += ns;
+}
+
+uint64_t nanos() {
+	return timeNanos;
+}
+} // namespace native
+
+GPIO_TypeDef *digitalPinToPort(uint32_t pin) {
+	native::initialisePins();
+	return &native::pinPorts[pin < NUM_DIGITAL_PINS ? pin : (uint32_t)NUM_DIGITAL_PINS];
+}
+
+uint32_t digitalPinToBitMask(uint32_t pin) {
+	return 1;
+}
+
+void pinMode(uint32_t pin, uint32_t mode) {
+	native::initialisePins();
+}
+
+void digitalWrite(uint32_t pin, uint32_t value) {
+	native::setPin(pin, value);
+}
+
+int digitalRead(uint32_t pin) {
+	native::initialisePins();
+	return digitalPinToPort(pin)->IDR & 1;
+}
+
+void digitalToggle(uint32_t pin) {
+	native::setPin(pin, !digitalRead(pin));
+}
+
+void analogWrite(uint32_t pin, uint32_t value) {
+	if (native::analogWriteHook)
+		native::analogWriteHook(pin, value);
+}
+
+uint32_t analogRead(uint32_t pin) {
+	return 512; // Centre of the 10-bit range
+}
+
+uint32_t millis() {
+	return (uint32_t)(native::timeNanos / 1000000);
+}
+
+uint32_t micros() {
+	return (uint32_t)(native::timeNanos / 1000);
+}
+
+void delay(uint32_t ms) {
+	native::advanceNanos((uint64_t)ms * 1000000);
+}
+
+void delayMicroseconds(uint32_t us) {
+	native::advanceNanos((uint64_t)us * 1000);
+}
+
+void noInterrupts() {}
+void interrupts() {}
+
+uint32_t HAL_GetUIDw0() {
+	return native::uid;
+}
+
+uint32_t HAL_GetUIDw1() {
+	return 0;
+}
+
+uint32_t HAL_GetUIDw2() {
+	return 0;
+}
+
+size_t Print::write(const uint8_t *buffer, size_t size) {
+	size_t n = 0;
+	while (size--)
+		n += write(*buffer++);
+	return n;
+}
+
+size_t Print::print(const char *str) {
+	return write((const uint8_t *)str, strlen(str));
+}
+
+size_t Print::print(char c) {
+	return write((uint8_t)c);
+}
+
+size_t Print::print(unsigned char n, int base) {
+	return print((unsigned long)n, base);
+}
+
+size_t Print::print(int n, int base) {
+	return print((long)n, base);
+}
+
+size_t Print::print(unsigned int n, int base) {
+	return print((unsigned long)n, base);
+}
+
+size_t Print::print(long n, int base) {
+	if (n < 0 && base == DEC)
+		return print('-') + print((unsigned long)-n, base);
+	return print((unsigned long)n, base);
+}
+
+size_t Print::print(unsigned long n, int base) {
+	char str[33];
+	snprintf(str, sizeof(str), (base == HEX) ? "%lX" : "%lu", n);
+	return print(str);
+}
+
+size_t Print::println(const char *str) {
+	return print(str) + print("\r\n");
+}
+
+size_t Print::println(int n, int base) {
+	return print(n, base) + print("\r\n");
+}
+
+size_t Print::println(unsigned long n, int base) {
+	return print(n, base) + print("\r\n");
+}
+
+HardwareSerial Serial;
+
+void HardwareSerial::begin(unsigned long baud) {}
+
+int HardwareSerial::available() {
+	return 0;
+}
+
+int HardwareSerial::read() {
+	return -1;
+}
+
+int HardwareSerial::availableForWrite() {
+	return 64;
+}
+
+size_t HardwareSerial::write(uint8_t c) {
+	return fputc(c, stdout) == EOF ? 0 : 1;
+}
+
+static TIM_TypeDef tim1 = {1};
+TIM_TypeDef *TIM1 = &tim1;
+
+HardwareTimer::HardwareTimer(TIM_TypeDef *instance) {
+	HardwareTimer::callback = nullptr;
+	HardwareTimer::overflow = 0;
+	HardwareTimer::running = false;
+}
+
+void HardwareTimer::setOverflow(uint32_t overflow, TimerFormat_t format) {
+	HardwareTimer::overflow = overflow;
+}
+
+void HardwareTimer::attachInterrupt(void (*callback)()) {
+	HardwareTimer::callback = callback;
+}
+
+void HardwareTimer::resume() {
+	running = true;
+}
+
+void HardwareTimer::pause() {
+	running = false;
+}
+
+bool HardwareTimer::isRunning() {
+	return running;
+}
+#pragma endregion
+
+#pragma region FreeRTOS
+struct QueueDefinition {
+	UBaseType_t length;
+	UBaseType_t itemSize;
+	std::deque<std::vector<uint8_t>> items;
+};
+
+struct TaskDefinition {
+	TaskFunction_t function;
+	const char *name;
+	uint16_t stackDepth;
+	UBaseType_t priority;
+	uint32_t notifyCount;
+};
+
+QueueHandle_t xQueueCreate(UBaseType_t length, UBaseType_t itemSize) {
+	return new QueueDefinition{length, itemSize, {}};
+}
+
+BaseType_t xQueueSend(QueueHandle_t queue, const void *item, TickType_t ticksToWait) {
+	if (queue->items.size() >= queue->length)
+		return errQUEUE_FULL;
+	const uint8_t *bytes = (const uint8_t *)item;
+	queue->items.emplace_back(bytes, bytes + queue->itemSize);
+	return pdPASS;
+}
+
+BaseType_t xQueueSendToFront(QueueHandle_t queue, const void *item, TickType_t ticksToWait) {
+	if (queue->items.size() >= queue->length)
+		return errQUEUE_FULL;
+	const uint8_t *bytes = (const uint8_t *)item;
+	queue->items.emplace_front(bytes, bytes + queue->itemSize);
+	return pdPASS;
+}
+
+BaseType_t xQueueSendFromISR(QueueHandle_t queue, const void *item, BaseType_t *higherPriorityTaskWoken) {
+	return xQueueSend(queue, item, 0);
+}
+
+BaseType_t xQueueReceive(QueueHandle_t queue, void *buffer, TickType_t ticksToWait) {
+	if (queue->items.empty())
+		return pdFALSE; // Would block forever, as nothing else runs
+	if (queue->itemSize)
+		memcpy(buffer, queue->items.front().data(), queue->itemSize);
+	queue->items.pop_front();
+	return pdTRUE;
+}
+
+BaseType_t xQueueReceiveFromISR(QueueHandle_t queue, void *buffer, BaseType_t *higherPriorityTaskWoken) {
+	return xQueueReceive(queue, buffer, 0);
+}
+
+UBaseType_t uxQueueMessagesWaiting(QueueHandle_t queue) {
+	return queue->items.size();
+}
+
+UBaseType_t uxQueueSpacesAvailable(QueueHandle_t queue) {
+	return queue->length - queue->items.size();
+}
+
+// As in FreeRTOS, a semaphore is a queue of zero size items, holding one item per available count
+SemaphoreHandle_t xSemaphoreCreateCounting(UBaseType_t maxCount, UBaseType_t initialCount) {
+	SemaphoreHandle_t semaphore = xQueueCreate(maxCount, 0);
+	for (UBaseType_t i = 0; i < initialCount; i++)
+		xQueueSend(semaphore, nullptr, 0);
+	return semaphore;
+}
+
+BaseType_t xSemaphoreTake(SemaphoreHandle_t semaphore, TickType_t ticksToWait) {
+	return xQueueReceive(semaphore, nullptr, ticksToWait);
+}
+
+BaseType_t xSemaphoreGive(SemaphoreHandle_t semaphore) {
+	return xQueueSend(semaphore, nullptr, 0);
+}
+
+BaseType_t xSemaphoreGiveFromISR(SemaphoreHandle_t semaphore, BaseType_t *higherPriorityTaskWoken) {
+	return xQueueSend(semaphore, nullptr, 0);
+}
+
+BaseType_t xTaskCreate(TaskFunction_t function, const char *name, uint16_t stackDepth, void *parameters, UBaseType_t priority, TaskHandle_t *handle) {
+	TaskHandle_t task = new TaskDefinition{function, name, stackDepth, priority, 0};
+	if (handle)
+		*handle = task;
+	return pdPASS;
+}
+
+void vTaskDelete(TaskHandle_t task) {}
+
+char *pcTaskGetName(TaskHandle_t task) {
+	return (char *)task->name;
+}
+
+// Tasks are never scheduled on the host, so none has used its stack
+UBaseType_t uxTaskGetStackHighWaterMark(TaskHandle_t task) {
+	return task->stackDepth;
+}
+
+void vTaskStartScheduler() {}
+
+TickType_t xTaskGetTickCount() {
+	return millis();
+}
+
+void vTaskDelay(TickType_t ticks) {
+	delay(ticks);
+}
+
+void vTaskDelayUntil(TickType_t *previousWakeTime, TickType_t timeIncrement) {
+	*previousWakeTime += timeIncrement;
+}
+
+void vTaskNotifyGiveFromISR(TaskHandle_t task, BaseType_t *higherPriorityTaskWoken) {
+	if (task)
+		task->notifyCount++;
+}
+
+BaseType_t xTaskNotifyGive(TaskHandle_t task) {
+	vTaskNotifyGiveFromISR(task, nullptr);
+	return pdPASS;
+}
+
+uint32_t ulTaskNotifyTake(BaseType_t clearCountOnExit, TickType_t ticksToWait) {
+	return 0; // There is no current task on the host
+}
+#pragma endregion
+
+const uint8_t u8g2_font_profont12_mf[] = {0};
@@ -0,0 +1,138 @@
+#include <sequencer>
+
+Sequencer::Sequencer(uint32_t samplingRate) : samplingRate(samplingRate) {
+	mode = SEQ_OFF;
+	gate = 2;
+	syncStep = -1;
+	clearRequest = false;
+	setTempo(120);
+	for (uint8_t i = 0; i < numSteps; i++)
+		pattern[i] = 0;
+	lastNote = 0;
+	random = 1;
+	stop();
+}
+
+void Sequencer::setMode(SequencerMode newMode) {
+	mode = newMode;
+}
+
+SequencerMode Sequencer::getMode() {
+	return (SequencerMode)mode.load();
+}
+
+void Sequencer::setTempo(uint32_t bpm) {
+	if (bpm)
+		stepLength = ((uint64_t)samplingRate * 60 * 256) / (bpm * 4); // Four steps per beat
+}
+
+void Sequencer::setGate(uint8_t quarters) {
+	gate = quarters < 1 ? 1 : quarters > gateQuarters ? gateQuarters : quarters;
+}
+
+uint32_t Sequencer::untilEvent() {
+	const uint32_t length = stepLength;
+	int8_t follow = syncStep.exchange(-1);
+	if (follow >= 0) {
+		if (follow == step && phase < length / 2) {
+			phase = 0; // Already began that step, only line up its start
+		} else {
+			step = (follow + numSteps - 1) % numSteps;
+			phase = length; // Begin it now
+		}
+	}
+	const uint8_t quarters = gate;
+	uint32_t target = (playing && quarters < gateQuarters) ? length / gateQuarters * quarters : length;
+	if (phase >= target)
+		return 0;
+	return (target - phase + 255) >> 8;
+}
+
+void Sequencer::advance(uint32_t samples) {
+	phase += samples << 8;
+}
+
+bool Sequencer::fire(const std::atomic<bool> *held, uint8_t numNotes, uint8_t &stopNote, uint8_t &startNote) {
+	const uint32_t length = stepLength;
+	stopNote = playing;
+	startNote = 0;
+	if (phase < length) { // End of the gate
+		playing = 0;
+		return false;
+	}
+	phase = phase < 2 * length ? phase - length : 0; // Keeps the fraction, unless the tempo has just gone up a lot
+	step = (step + 1) % numSteps;
+	if (clearRequest.exchange(false)) {
+		for (uint8_t i = 0; i < numSteps; i++)
+			pattern[i] = 0;
+	}
+	playing = nextNote(held, numNotes);
+	startNote = playing;
+	return true;
+}
+
+// Note for the step just begun, 0 for a rest
+uint8_t Sequencer::nextNote(const std::atomic<bool> *held, uint8_t numNotes) {
+	uint8_t count = 0, lowest = 0, highest = 0, above = 0, below = 0;
+	for (uint8_t note = 1; note < numNotes; note++) {
+		if (!held[note])
+			continue;
+		count++;
+		if (!lowest)
+			lowest = note;
+		highest = note;
+		if (note > lastNote && !above)
+			above = note;
+		if (note < lastNote)
+			below = note;
+	}
+	if (mode == SEQ_PATTERN) {
+		if (lowest)
+			pattern[step] = lowest;
+		return pattern[step];
+	}
+	if (!count)
+		return 0;
+	uint8_t note = 0;
+	switch (mode) {
+		case SEQ_UP:
+			note = above ? above : lowest;
+			break;
+		case SEQ_DOWN:
+			note = below ? below : highest;
+			break;
+		case SEQ_RANDOM: {
+			random = random * 1664525 + 1013904223; // Numerical Recipes LCG, the top bits are the most random
+			uint8_t pick = (random >> 16) % count;
+			for (note = lowest; pick || !held[note]; note++) {
+				if (held[note] && pick)
+					pick--;
+			}
+			break;
+		}
+		default:
+			return 0;
+	}
+	lastNote = note;
+	return note;
+}
+
+uint8_t Sequencer::getStep() {
+	return step;
+}
+
+uint8_t Sequencer::stop() {
+	uint8_t note = playing;
+	playing = 0;
+	step = numSteps - 1;
+	phase = stepLength; // The first step begins as soon as it is used again
+	return note;
+}
+
+void Sequencer::sync(uint8_t newStep) {
+	syncStep = newStep % numSteps;
+}
+
+void Sequencer::clearPattern() {
+	clearRequest = true;
+}
@@ -0,0 +1,497 @@
+#include <samples.h>
+#include <synth>
+#include <tables>
+#include <wavetables.h>
+
+// Mixer gain in Q16 indexed by number of active voices, 1/sqrt(n) to keep headroom for chords
+constexpr Table<int32_t, Synth::numVoices + 1> mixGain = makeInverseSqrtTable<Synth::numVoices + 1>(65536);
+constexpr Table<int16_t, (1 << wavetableBits) + 1> sineTable = makeSineTable<1 << wavetableBits>();
+// Q15 pan gains by note, spread over 60% of the stereo field so no note is only in one speaker
+constexpr Table<int16_t, numNotes> panLeft = makePanTable<numNotes>(0.6, false);
+constexpr Table<int16_t, numNotes> panRight = makePanTable<numNotes>(0.6, true);
+
+// The attack aims past full level so it reaches it in finite time, and the release aims below silence for the same reason
+const int32_t attackTarget = Synth::envelopeFull + Synth::envelopeFull / 2;
+const int32_t releaseTarget = -Synth::envelopeFull / 64;
+// Phase offset of a 32-bit phase per unit of Q15 modulator output per Q8 radian, 2^32 / (2 pi 32768 256), in Q10
+const int64_t fmPhasePerIndex = 83443;
+// Frequency of each FM modulator as a multiple of the carrier's, from the one modulating the carrier up the stack
+const uint32_t fmRatios[Synth::maxOperators - 1] = {1, 2, 3};
+
+Synth::Synth() {
+	Synth::activeVoices = 0;
+	Synth::noteCounter = 0;
+	mixLevel = mixGain[1];
+	stereo = true;
+	setWaveform(SAWTOOTH);
+	setEnvelope(65536, 65536, 65536, 65536);
+	setPitchFactor(65536);
+	operators = 2;
+	setFM(2, 0, 0);
+	for (uint8_t i = 0; i < numVoices; i++) {
+		phaseAcc[i] = 0;
+		stepSize[i] = 0;
+		startTime[i] = 0;
+		note[i] = 0;
+		envelopeLevel[i] = rampLevel[i] = 0;
+		envelopeStage[i] = FINISHED;
+		for (uint8_t k = 0; k < maxOperators - 1; k++)
+			operatorPhase[i][k] = 0;
+		feedbackOutput[i][0] = feedbackOutput[i][1] = 0;
+	}
+}
+
+uint8_t Synth::getActiveVoices() {
+	return activeVoices;
+}
+
+// Returns a free voice slot, stealing the oldest released voice, or the oldest voice if none are released,
+// when the pool is full
+uint8_t Synth::allocateVoice() {
+	if (activeVoices < numVoices)
+		return activeVoices++;
+	uint8_t oldest = 0;
+	for (uint8_t i = 1; i < numVoices; i++) {
+		bool released = envelopeStage[i] == RELEASE, oldestReleased = envelopeStage[oldest] == RELEASE;
+		if ((released && !oldestReleased) ||
+			(released == oldestReleased && (int32_t)(startTime[i] - startTime[oldest]) < 0))
+			oldest = i;
+	}
+	return oldest;
+}
+
+// Swap the last active voice into the freed slot to keep active voices packed
+void Synth::freeVoice(uint8_t voice) {
+	uint8_t last = --activeVoices;
+	phaseAcc[voice] = phaseAcc[last];
+	stepSize[voice] = stepSize[last];
+	startTime[voice] = startTime[last];
+	note[voice] = note[last];
+	envelopeLevel[voice] = envelopeLevel[last];
+	rampLevel[voice] = rampLevel[last];
+	envelopeStage[voice] = envelopeStage[last];
+	sampleVoice[voice] = sampleVoice[last];
+	for (uint8_t k = 0; k < maxOperators - 1; k++)
+		operatorPhase[voice][k] = operatorPhase[last][k];
+	feedbackOutput[voice][0] = feedbackOutput[last][0];
+	feedbackOutput[voice][1] = feedbackOutput[last][1];
+}
+
+// Sampled instrument for a note, the one with the highest root at or below it, allowing for rounding of the step sizes
+static const AdpcmSample *sampleFor(int32_t stepSize) {
+	uint8_t chosen = 0;
+	for (uint8_t i = 1; i < sampleCount; i++) {
+		if (sampleBank[i].rootStep <= (uint32_t)stepSize + (stepSize >> 6))
+			chosen = i;
+	}
+	return &sampleBank[chosen];
+}
+
+void Synth::noteOn(uint8_t newNote, int32_t newStepSize) {
+	uint8_t voice = activeVoices;
+	for (uint8_t i = 0; i < activeVoices; i++) {
+		if (note[i] == newNote) { // Retrigger if note is already sounding, e.g. pressed on two boards
+			voice = i;
+			break;
+		}
+	}
+	if (voice == activeVoices) {
+		const bool stolen = activeVoices == numVoices;
+		voice = allocateVoice();
+		if (!stolen) {
+			phaseAcc[voice] = 0;
+			envelopeLevel[voice] = rampLevel[voice] = 0;
+			for (uint8_t k = 0; k < maxOperators - 1; k++)
+				operatorPhase[voice][k] = 0;
+			feedbackOutput[voice][0] = feedbackOutput[voice][1] = 0;
+		}
+	}
+	// A retriggered or stolen voice attacks from its current level, and its oscillators carry on from their phase, so
+	// it does not click
+	envelopeStage[voice] = ATTACK;
+	stepSize[voice] = newStepSize;
+	sampleVoice[voice].start(sampleFor(newStepSize)); // Whatever the waveform, so it can be changed while notes sound
+	startTime[voice] = noteCounter++;
+	note[voice] = newNote;
+}
+
+void Synth::noteOff(uint8_t oldNote) {
+	for (uint8_t i = 0; i < activeVoices; i++) {
+		if (note[i] == oldNote && envelopeStage[i] != FINISHED)
+			envelopeStage[i] = RELEASE;
+	}
+}
+
+void Synth::allNotesOff() {
+	activeVoices = 0;
+}
+
+void Synth::setEnvelope(int32_t attack, int32_t decay, int32_t sustain, int32_t release) {
+	attackCoefficient = attack;
+	decayCoefficient = decay;
+	sustainLevel = sustain << 8; // Q16 to envelope level
+	releaseCoefficient = release;
+}
+
+void Synth::setPitchFactor(int32_t factor) {
+	pitchFactor = factor;
+}
+
+// Level of a voice's envelope one block along its segment, with one multiply-add. Only stored with the stage it
+// moves on to if commit is set, so the parts of a split block all aim for the same level
+inline int32_t Synth::advanceEnvelope(uint8_t voice, bool commit) {
+	int32_t level = envelopeLevel[voice];
+	uint8_t stage = envelopeStage[voice];
+	const int32_t sustain = sustainLevel;
+	switch (stage) {
+		case ATTACK:
+			level += ((int64_t)(attackTarget - level) * attackCoefficient) >> 16;
+			if (level >= envelopeFull) {
+				level = envelopeFull;
+				stage = DECAY;
+			}
+			break;
+		case DECAY:
+			level += ((int64_t)(sustain - level) * decayCoefficient) >> 16;
+			if (level - sustain < (envelopeFull >> 10)) { // Within 0.1% of sustain
+				level = sustain;
+				stage = SUSTAIN;
+			}
+			break;
+		case SUSTAIN:
+			level = sustain; // Follows the sustain setting while held
+			break;
+		case RELEASE:
+			level += ((int64_t)(releaseTarget - level) * releaseCoefficient) >> 16;
+			if (level <= 0) {
+				level = 0;
+				stage = FINISHED;
+			}
+			break;
+		default:
+			level = 0;
+	}
+	if (commit) {
+		envelopeLevel[voice] = level;
+		envelopeStage[voice] = stage;
+	}
+	return level;
+}
+// Select the mip level with every harmonic below Nyquist for this step size
+inline uint32_t wavetableLevel(uint32_t step) {
+	int32_t level = 31 - __builtin_clz(step | 1) - wavetableLowestLevelBits;
+	if (level < 0)
+		return 0;
+	if (level >= (int32_t)wavetableLevels)
+		return wavetableLevels - 1;
+	return level;
+}
+
+// Wavetable to play for a voice with this step size
+template <uint8_t W>
+inline const int16_t *wavetable(uint32_t step);
+
+template <>
+inline const int16_t *wavetable<SQUARE>(uint32_t step) {
+	return squareTables[wavetableLevel(step)];
+}
+
+template <>
+inline const int16_t *wavetable<SAWTOOTH>(uint32_t step) {
+	return sawtoothTables[wavetableLevel(step)];
+}
+
+template <>
+inline const int16_t *wavetable<TRIANGLE>(uint32_t step) {
+	return triangleTables[wavetableLevel(step)];
+}
+
+// The step size is unused, but kept so renderWaveform() calls every waveform alike
+template <>
+inline const int16_t *wavetable<SINE>([[maybe_unused]] uint32_t step) {
+	return sineTable.values; // Single harmonic, no mip levels needed
+}
+
+// Envelope gains of a voice ramped linearly across the block to the envelope's next level, for the part of the block
+// from offset. Each part carries on from where the last one left the ramp, over the rest of the block, so a note
+// started or released at a split only bends the ramp. The envelope is advanced by the part that ends the block
+// In stereo the pan is folded into a separate gain ramp for each channel, so each sample is only generated once
+template <bool Stereo>
+inline Synth::VoiceGain Synth::voiceGain(uint8_t voice, uint32_t offset, uint32_t length, uint32_t blockLength) {
+	const bool last = offset + length == blockLength;
+	const int32_t remaining = blockLength - offset;
+	const int32_t gain = rampLevel[voice];
+	const int32_t level = advanceEnvelope(voice, last);
+	const int32_t step = (level - gain) / remaining;
+	rampLevel[voice] = last ? level : gain + step * (int32_t)length;
+	VoiceGain result;
+	result.left = result.right = gain;
+	result.stepLeft = result.stepRight = step;
+	if (Stereo) {
+		const int32_t panL = panLeft[note[voice]], panR = panRight[note[voice]];
+		result.left = ((int64_t)gain * panL) >> 15;
+		result.right = ((int64_t)gain * panR) >> 15;
+		result.stepLeft = ((((int64_t)level * panL) >> 15) - result.left) / remaining;
+		result.stepRight = ((((int64_t)level * panR) >> 15) - result.right) / remaining;
+	}
+	return result;
+}
+
+// Add every active voice to the block, one voice at a time so each voice's phase accumulator, step size
+// and envelope gain stay in registers for the whole block
+// Pitch bend scales the step size once per block, so it costs nothing per sample
+template <uint8_t W, bool Stereo>
+void Synth::renderWaveform(Synth &synth, int32_t *left, int32_t *right, uint32_t offset, uint32_t length,
+							   uint32_t blockLength) {
+	const uint32_t indexShift = 32 - wavetableBits;
+	const int32_t bend = synth.pitchFactor;
+	for (uint8_t i = 0; i < synth.activeVoices; i++) {
+		uint32_t phase = synth.phaseAcc[i];
+		const uint32_t step = ((int64_t)synth.stepSize[i] * bend) >> 16;
+		const int16_t *table = wavetable<W>(step);
+		VoiceGain gain = synth.voiceGain<Stereo>(i, offset, length, blockLength);
+		for (uint32_t j = 0; j < length; j++) {
+			phase += step;
+			uint32_t index = phase >> indexShift;
+			int32_t fraction = (phase >> (indexShift - 15)) & 0x7FFF; // 15 bits, so the product below fits in 32 bits
+			int32_t sample = table[index];
+			sample += ((table[index + 1] - sample) * fraction) >> 15;
+			left[j] += (sample * (gain.left >> 9)) >> 15; // Envelope level to Q15
+			gain.left += gain.stepLeft;
+			if (Stereo) {
+				right[j] += (sample * (gain.right >> 9)) >> 15;
+				gain.right += gain.stepRight;
+			}
+		}
+		synth.phaseAcc[i] = phase;
+	}
+}
+
+// Samples are decoded a chunk at a time, after the two carried over from the last chunk, then resampled from there
+static const uint32_t sampleChunk = 128;
+// Q16 samples per output sample. A chunk then lasts at least 7 output samples, not 8, as the position carried into it
+// can be up to one sample past decoded[0]
+static const uint32_t maxSampleRate = 16 << 16;
+static int16_t decoded[sampleChunk + 2]; // Only used by renderTask(), whose stack is too small for it
+
+// Add every active voice's sample to the block, decoding from flash only the samples the block plays
+// Each output sample is interpolated between the two decoded samples either side of its position, which moves on by
+// the voice's rate, so there is no decoding or looping in the resampling loop
+template <bool Stereo>
+void Synth::renderSamples(Synth &synth, int32_t *left, int32_t *right, uint32_t offset, uint32_t length,
+						  uint32_t blockLength) {
+	const int32_t bend = synth.pitchFactor;
+	for (uint8_t i = 0; i < synth.activeVoices; i++) {
+		AdpcmVoice &voice = synth.sampleVoice[i];
+		const uint32_t step = ((int64_t)synth.stepSize[i] * bend) >> 16;
+		uint32_t rate = voice.rate(step);
+		rate = rate > maxSampleRate ? maxSampleRate : rate ? rate : 1;
+		const bool loop = synth.envelopeStage[i] != RELEASE;
+		VoiceGain gain = synth.voiceGain<Stereo>(i, offset, length, blockLength);
+		uint32_t position = voice.fraction; // Q16 from decoded[0]
+		for (uint32_t j = 0; j < length;) {
+			uint32_t count = (((sampleChunk + 1) << 16) - 1 - position) / rate; // Output samples within one chunk
+			if (count > length - j)
+				count = length - j;
+			const uint32_t fresh = (position + rate * count) >> 16; // Samples to decode, past the carried two
+			decoded[0] = voice.carry[0];
+			decoded[1] = voice.carry[1];
+			voice.decode(decoded + 2, fresh, loop);
+			for (const uint32_t end = j + count; j < end; j++) {
+				uint32_t index = position >> 16;
+				int32_t fraction = (position >> 1) & 0x7FFF;
+				int32_t sample = decoded[index];
+				sample += ((decoded[index + 1] - sample) * fraction) >> 15;
+				left[j] += (sample * (gain.left >> 9)) >> 15;
+				gain.left += gain.stepLeft;
+				if (Stereo) {
+					right[j] += (sample * (gain.right >> 9)) >> 15;
+					gain.right += gain.stepRight;
+				}
+				position += rate;
+			}
+			voice.carry[0] = decoded[fresh];
+			voice.carry[1] = decoded[fresh + 1];
+			position &= 0xFFFF;
+		}
+		voice.fraction = position;
+	}
+}
+
+// Interpolated Q15 sine of a 32-bit phase, from the table shared with the SINE waveform
+inline int32_t sineAt(uint32_t phase) {
+	const uint32_t indexShift = 32 - wavetableBits;
+	uint32_t index = phase >> indexShift;
+	int32_t fraction = (phase >> (indexShift - 15)) & 0x7FFF;
+	int32_t sample = sineTable[index];
+	return sample + (((sineTable[index + 1] - sample) * fraction) >> 15);
+}
+
+// Add every active voice's operator stack to the block, with the operators unrolled for each stack height
+// Each modulator's output, times the modulation index, is added to the phase of the operator below. The products are
+// taken modulo 2^32, as the phase is, so a large index wraps round the sine rather than overflowing
+// The top modulator is fed back the average of its last two outputs, which keeps high feedback from oscillating
+template <uint8_t Operators, bool Stereo>
+void Synth::renderFM(Synth &synth, int32_t *left, int32_t *right, uint32_t offset, uint32_t length,
+					 uint32_t blockLength) {
+	const uint8_t top = Operators - 2;
+	const int32_t bend = synth.pitchFactor;
+	const uint32_t depth = synth.fmDepth, feedback = synth.fmFeedback;
+	for (uint8_t i = 0; i < synth.activeVoices; i++) {
+		const uint32_t step = ((int64_t)synth.stepSize[i] * bend) >> 16;
+		uint32_t carrier = synth.phaseAcc[i];
+		uint32_t phase[Operators - 1], modulatorStep[Operators - 1];
+		for (uint8_t k = 0; k < Operators - 1; k++) {
+			phase[k] = synth.operatorPhase[i][k];
+			modulatorStep[k] = step * fmRatios[k];
+		}
+		int32_t latest = synth.feedbackOutput[i][0], previous = synth.feedbackOutput[i][1];
+		VoiceGain gain = synth.voiceGain<Stereo>(i, offset, length, blockLength);
+		const uint32_t index = ((int64_t)depth * synth.rampLevel[i]) >> 24;
+		for (uint32_t j = 0; j < length; j++) {
+			phase[top] += modulatorStep[top];
+			int32_t modulation = sineAt(phase[top] + (uint32_t)(latest + previous) * feedback);
+			previous = latest;
+			latest = modulation;
+			for (int8_t k = top - 1; k >= 0; k--) {
+				phase[k] += modulatorStep[k];
+				modulation = sineAt(phase[k] + (uint32_t)modulation * index);
+			}
+			carrier += step;
+			int32_t sample = sineAt(carrier + (uint32_t)modulation * index);
+			left[j] += (sample * (gain.left >> 9)) >> 15;
+			gain.left += gain.stepLeft;
+			if (Stereo) {
+				right[j] += (sample * (gain.right >> 9)) >> 15;
+				gain.right += gain.stepRight;
+			}
+		}
+		synth.phaseAcc[i] = carrier;
+		for (uint8_t k = 0; k < Operators - 1; k++)
+			synth.operatorPhase[i][k] = phase[k];
+		synth.feedbackOutput[i][0] = latest;
+		synth.feedbackOutput[i][1] = previous;
+	}
+}
+
+template <uint8_t W>
+void Synth::selectKernel() {
+	if (stereo) {
+		renderVoices = renderWaveform<W, true>;
+	} else {
+		renderVoices = renderWaveform<W, false>;
+	}
+}
+
+template <uint8_t Operators>
+void Synth::selectFMKernel() {
+	if (stereo) {
+		renderVoices = renderFM<Operators, true>;
+	} else {
+		renderVoices = renderFM<Operators, false>;
+	}
+}
+
+void Synth::setWaveform(uint8_t newWaveform) {
+	switch (newWaveform) {
+		case SQUARE:
+			selectKernel<SQUARE>();
+			break;
+		case SAWTOOTH:
+			selectKernel<SAWTOOTH>();
+			break;
+		case TRIANGLE:
+			selectKernel<TRIANGLE>();
+			break;
+		case SINE:
+			selectKernel<SINE>();
+			break;
+		case SAMPLE:
+			if (stereo) {
+				renderVoices = renderSamples<true>;
+			} else {
+				renderVoices = renderSamples<false>;
+			}
+			break;
+		case FM:
+			if (operators == 4) {
+				selectFMKernel<4>();
+			} else if (operators == 3) {
+				selectFMKernel<3>();
+			} else {
+				selectFMKernel<2>();
+			}
+			break;
+		default:
+			return;
+	}
+	waveform = newWaveform;
+}
+
+void Synth::setStereo(bool newStereo) {
+	stereo = newStereo;
+	setWaveform(waveform);
+}
+
+// The feedback is applied to the sum of the top modulator's last two outputs, so it is halved
+void Synth::setFM(uint8_t newOperators, int32_t depth, int32_t feedback) {
+	fmDepth = (depth * fmPhasePerIndex) >> 10;
+	fmFeedback = (feedback * fmPhasePerIndex) >> 11;
+	if (newOperators < 2 || newOperators > maxOperators || newOperators == operators)
+		return;
+	operators = newOperators;
+	if (waveform == FM)
+		setWaveform(FM);
+}
+
+bool Synth::getStereo() {
+	return stereo;
+}
+
+uint8_t Synth::getWaveform() {
+	return waveform;
+}
+
+// Scale a mix bus by the mixer gain, moving it on by step each sample, and saturate it to signed 16-bit range
+static void finishMix(int32_t *out, uint32_t length, int32_t gain, int32_t step) {
+	for (uint32_t j = 0; j < length; j++) {
+		int32_t mix = (int32_t)(((int64_t)out[j] * gain) >> 16);
+		gain += step;
+		if (mix > 0x7FFF) // Saturate, as 1/sqrt(n) gain only guarantees headroom for uncorrelated voices
+			mix = 0x7FFF;
+		if (mix < -0x8000)
+			mix = -0x8000;
+		out[j] = mix;
+	}
+}
+
+// Render a block of mixed output in signed 16-bit range, into left and right in stereo or only left in mono
+// Returns true if the block is stereo
+bool Synth::renderBlock(int32_t *left, int32_t *right, uint32_t length) {
+	return renderSegment(left, right, 0, length, length);
+}
+
+bool Synth::renderSegment(int32_t *left, int32_t *right, uint32_t offset, uint32_t length, uint32_t blockLength) {
+	const uint8_t count = activeVoices;
+	const bool stereoBlock = stereo;
+	for (uint32_t j = 0; j < length; j++)
+		left[j] = 0;
+	if (stereoBlock) {
+		for (uint32_t j = 0; j < length; j++)
+			right[j] = 0;
+	}
+	renderVoices.load()(*this, left, right, offset, length, blockLength);
+	for (uint8_t i = activeVoices; i > 0; i--) {
+		if (envelopeStage[i - 1] == FINISHED)
+			freeVoice(i - 1);
+	}
+	// Ramp the mixer gain across the rest of the block as voiceGain() does the envelopes, holding it while silent so
+	// the next note starts at the gain of the last
+	const int32_t target = count ? mixGain[count] : mixLevel;
+	const int32_t step = (target - mixLevel) / (int32_t)(blockLength - offset);
+	finishMix(left, length, mixLevel, step);
+	if (stereoBlock)
+		finishMix(right, length, mixLevel, step);
+	mixLevel = offset + length == blockLength ? target : mixLevel + step * (int32_t)length;
+	return stereoBlock;
+}
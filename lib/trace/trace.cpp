@@ -0,0 +1,228 @@
+#ifdef ENABLE_TRACE
+
+#include <Arduino.h>
+#include <STM32FreeRTOS.h>
+#include <atomic>
+#include <trace>
+#ifdef NATIVE_BUILD
+#include <chrono>
+#endif
+
+const uint32_t traceRingSize = 512;		   // Events, must be a power of 2
+const uint32_t traceDrainInterval = 2;	   // ms, the ring holds 2ms of events from every task
+const uint32_t traceReportInterval = 1000; // ms
+const uint32_t traceBuckets = 100;		   // 4 buckets per power of 2, up to 2^26 cycles
+const char *traceNames[TRACE_NUM_IDS] = {"DAC_DMA_ISR", "CAN_RX_ISR", "renderTask", "scanKeysTask", "decodeTask", "displayUpdateTask", "CAN_TX_ISR", "CAN_TX_Task"};
+
+// info holds the low 24 bits of the event index, so a slot can be checked for being written, then the ID and exit flag
+struct TraceEvent {
+	uint32_t cycles;
+	std::atomic<uint32_t> info;
+};
+
+struct TraceStats {
+	uint32_t count;
+	uint32_t min, max;
+	uint64_t total;
+	uint32_t histogram[traceBuckets];
+};
+
+// Execution that has been entered but not exited, nested when preempted
+struct TraceFrame {
+	uint8_t id;
+	uint32_t resumed;
+	uint32_t elapsed;
+};
+
+TraceEvent traceRing[traceRingSize];
+std::atomic<uint32_t> traceHead;
+uint32_t traceTail = 0;
+uint32_t traceDropped = 0;
+uint32_t traceWindowStart = 0;
+TraceStats traceStats[TRACE_NUM_IDS];
+TraceFrame traceStack[TRACE_NUM_IDS];
+uint8_t traceDepth = 0;
+
+uint32_t traceCycles() {
+#ifdef NATIVE_BUILD
+	return (uint32_t)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+#else
+	return DWT->CYCCNT;
+#endif
+}
+
+// Cycle counter frequency, used by the host decoder to convert to time
+uint32_t traceCyclesPerSecond() {
+#ifdef NATIVE_BUILD
+	return 1000000000;
+#else
+	return SystemCoreClock;
+#endif
+}
+
+void traceResetStats() {
+	for (uint8_t i = 0; i < TRACE_NUM_IDS; i++) {
+		TraceStats &stats = traceStats[i];
+		stats.count = 0;
+		stats.min = UINT32_MAX;
+		stats.max = 0;
+		stats.total = 0;
+		for (uint32_t j = 0; j < traceBuckets; j++)
+			stats.histogram[j] = 0;
+	}
+}
+
+void traceInit() {
+#ifndef NATIVE_BUILD
+	CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk; // Enable the DWT cycle counter
+	DWT->CYCCNT = 0;
+	DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+#endif
+	traceHead = 0;
+	traceResetStats();
+	traceWindowStart = traceCycles();
+}
+
+// The timestamp is taken inside the compare and swap loop, so event order in the ring always matches timestamp order,
+// even if an ISR records events between reading the head and claiming the slot
+void traceEvent(uint8_t id, bool exit) {
+	uint32_t index, cycles;
+	do {
+		index = traceHead.load(std::memory_order_relaxed);
+		cycles = traceCycles();
+	} while (!traceHead.compare_exchange_weak(index, index + 1, std::memory_order_relaxed));
+	TraceEvent &event = traceRing[index & (traceRingSize - 1)];
+	event.cycles = cycles;
+	event.info.store((index << 8) | (id << 1) | exit, std::memory_order_release);
+}
+
+uint8_t traceBucket(uint32_t cycles) {
+	if (cycles < 4)
+		return cycles;
+	uint32_t exponent = 31 - __builtin_clz(cycles);
+	uint32_t bucket = 4 * (exponent - 1) + ((cycles >> (exponent - 2)) & 0x3);
+	return bucket < traceBuckets ? bucket : traceBuckets - 1;
+}
+
+uint32_t traceBucketUpperBound(uint32_t bucket) {
+	if (bucket < 4)
+		return bucket;
+	uint32_t exponent = bucket / 4 + 1;
+	return ((5 + bucket % 4) << (exponent - 2)) - 1;
+}
+
+void traceRecord(uint8_t id, uint32_t cycles) {
+	TraceStats &stats = traceStats[id];
+	stats.count++;
+	stats.total += cycles;
+	if (cycles < stats.min)
+		stats.min = cycles;
+	if (cycles > stats.max)
+		stats.max = cycles;
+	stats.histogram[traceBucket(cycles)]++;
+}
+
+void traceDrain() {
+	while (1) {
+		uint32_t head = traceHead.load(std::memory_order_acquire);
+		if (head - traceTail > traceRingSize) { // Overwritten before being read, nesting is no longer known
+			traceDropped += head - traceTail - traceRingSize;
+			traceTail = head - traceRingSize;
+			traceDepth = 0;
+		}
+		if (traceTail == head)
+			return;
+		TraceEvent &event = traceRing[traceTail & (traceRingSize - 1)];
+		uint32_t info = event.info.load(std::memory_order_acquire);
+		uint32_t cycles = event.cycles;
+		if (((info >> 8) ^ traceTail) & 0xffffff) {
+			if ((int32_t)(((info >> 8) - traceTail) << 8) > 0) { // Slot reused by a newer event
+				traceDropped++;
+				traceTail++;
+				traceDepth = 0;
+				continue;
+			}
+			return; // Slot claimed but not yet written
+		}
+		if (event.info.load(std::memory_order_acquire) != info) // Overwritten while being read
+			continue;
+		traceTail++;
+		uint8_t id = (info >> 1) & 0x7f;
+		if (id >= TRACE_NUM_IDS)
+			continue;
+		if (!(info & 1)) {
+			if (traceDepth) { // Preempting the execution on top of the stack
+				TraceFrame &top = traceStack[traceDepth - 1];
+				top.elapsed += cycles - top.resumed;
+			}
+			if (traceDepth < TRACE_NUM_IDS)
+				traceStack[traceDepth++] = {id, cycles, 0};
+		} else if (traceDepth && traceStack[traceDepth - 1].id == id) {
+			TraceFrame &top = traceStack[--traceDepth];
+			traceRecord(id, top.elapsed + cycles - top.resumed);
+			if (traceDepth)
+				traceStack[traceDepth - 1].resumed = cycles;
+		} else { // Unmatched exit, e.g. started before tracing or after a drop
+			traceDepth = 0;
+		}
+	}
+}
+
+// One CSV line per ID: T,name,count,min,avg,p99,max,total, all in cycles, then the window length and drops
+void traceReport() {
+	uint32_t now = traceCycles();
+	Serial.print("T,clock,");
+	Serial.println((unsigned long)traceCyclesPerSecond());
+	for (uint8_t i = 0; i < TRACE_NUM_IDS; i++) {
+		TraceStats &stats = traceStats[i];
+		uint32_t p99 = 0;
+		uint32_t target = stats.count - stats.count / 100;
+		uint32_t seen = 0;
+		for (uint32_t j = 0; j < traceBuckets && stats.count; j++) {
+			seen += stats.histogram[j];
+			if (seen >= target) {
+				p99 = traceBucketUpperBound(j);
+				break;
+			}
+		}
+		if (p99 > stats.max)
+			p99 = stats.max;
+		Serial.print("T,");
+		Serial.print(traceNames[i]);
+		Serial.print(",");
+		Serial.print((unsigned long)stats.count);
+		Serial.print(",");
+		Serial.print((unsigned long)(stats.count ? stats.min : 0));
+		Serial.print(",");
+		Serial.print((unsigned long)(stats.count ? stats.total / stats.count : 0));
+		Serial.print(",");
+		Serial.print((unsigned long)p99);
+		Serial.print(",");
+		Serial.print((unsigned long)stats.max);
+		Serial.print(",");
+		Serial.println((unsigned long)stats.total);
+	}
+	Serial.print("T,window,");
+	Serial.print((unsigned long)(now - traceWindowStart));
+	Serial.print(",");
+	Serial.println((unsigned long)traceDropped);
+	traceResetStats();
+	traceDropped = 0;
+	traceWindowStart = now;
+}
+
+void traceTask(void *pvParameters) {
+	const TickType_t xFrequency = traceDrainInterval / portTICK_PERIOD_MS;
+	TickType_t xLastWakeTime = xTaskGetTickCount();
+	TickType_t lastReport = xLastWakeTime;
+	while (1) {
+		vTaskDelayUntil(&xLastWakeTime, xFrequency);
+		traceDrain();
+		if (xLastWakeTime - lastReport >= traceReportInterval / portTICK_PERIOD_MS) {
+			lastReport = xLastWakeTime;
+			traceReport();
+		}
+	}
+}
+
+#endif
@@ -0,0 +1,269 @@
+#include <ui>
+
+const unsigned char waveforms[6][18] = {
+	{0x7f, 0x10, 0x41, 0x10, 0x41, 0x10, 0x41, 0x10, 0x41,
+	 0x10, 0x41, 0x10, 0x41, 0x10, 0x41, 0x10, 0xc1, 0x1f}, // Square Wave
+	{0x70, 0x10, 0x58, 0x18, 0x48, 0x08, 0x4c, 0x0c, 0x44,
+	 0x04, 0x46, 0x06, 0x42, 0x02, 0x43, 0x03, 0xc1, 0x01}, // Sawtooth Wave
+	{0x08, 0x00, 0x1c, 0x00, 0x36, 0x00, 0x63, 0x00, 0xc1,
+	 0x00, 0x80, 0x11, 0x00, 0x1b, 0x00, 0x0e, 0x00, 0x04}, // Triangle Wave
+	{0x1c, 0x00, 0x36, 0x00, 0x22, 0x00, 0x63, 0x00, 0x41,
+	 0x10, 0xc0, 0x18, 0x80, 0x08, 0x80, 0x0d, 0x00, 0x07}, // Sine Wave
+	{0x01, 0x00, 0x15, 0x00, 0x55, 0x01, 0x55, 0x15, 0xff,
+	 0x1f, 0x55, 0x15, 0x55, 0x01, 0x15, 0x00, 0x01, 0x00}, // Sample
+	{0x00, 0x00, 0x5e, 0x04, 0xc2, 0x06, 0x42, 0x05, 0x4e,
+	 0x04, 0x42, 0x04, 0x42, 0x04, 0x42, 0x04, 0x00, 0x00} // FM
+};
+const unsigned char volumes[6][18] = {
+	{0x10, 0x00, 0x18, 0x00, 0x5c, 0x04, 0x9f, 0x02, 0x1f,
+	 0x01, 0x9f, 0x02, 0x5c, 0x04, 0x18, 0x00, 0x10, 0x00}, // mute
+	{0x10, 0x00, 0x18, 0x00, 0x1c, 0x00, 0x1f, 0x00, 0x5f,
+	 0x00, 0x1f, 0x00, 0x1c, 0x00, 0x18, 0x00, 0x10, 0x00}, // volume lowest
+	{0x10, 0x00, 0x18, 0x00, 0x1c, 0x00, 0x5f, 0x00, 0x5f,
+	 0x00, 0x5f, 0x00, 0x1c, 0x00, 0x18, 0x00, 0x10, 0x00}, // volume low
+	{0x10, 0x00, 0x18, 0x00, 0x1c, 0x01, 0x5f, 0x01, 0x5f,
+	 0x01, 0x5f, 0x01, 0x1c, 0x01, 0x18, 0x00, 0x10, 0x00}, // volume mid lower
+	{0x10, 0x00, 0x98, 0x00, 0x1c, 0x01, 0x5f, 0x01, 0x5f,
+	 0x01, 0x5f, 0x01, 0x1c, 0x01, 0x98, 0x00, 0x10, 0x00}, // volume mid higher
+	{0x10, 0x02, 0x98, 0x04, 0x1c, 0x05, 0x5f, 0x09, 0x5f,
+	 0x09, 0x5f, 0x09, 0x1c, 0x05, 0x98, 0x04, 0x10, 0x02}, // volume max
+};
+
+// Envelope setting shown above each knob in envelope mode, as a letter and the setting
+static void drawEnvelopeSetting(U8G2 &u8g2, const DisplayState &state, uint8_t knob, uint8_t x) {
+	const char labels[] = "ADSR";
+	char text[4] = {labels[knob], (char)('0' + state.envelope[knob] / 10), (char)('0' + state.envelope[knob] % 10), '\0'};
+	u8g2.drawStr(x, 30, text);
+}
+
+// Filter setting shown above knobs 0-2 in filter mode, the type by name and the others as a letter and the setting
+static void drawFilterSetting(U8G2 &u8g2, const DisplayState &state, uint8_t knob, uint8_t x) {
+	if (knob == 0) {
+		const char *types[] = {"OFF", "LP", "HP", "BP"};
+		u8g2.drawStr(x, 30, types[state.filter[0]]);
+		return;
+	}
+	char text[4] = {knob == 1 ? 'C' : 'Q', (char)('0' + state.filter[knob] / 10), (char)('0' + state.filter[knob] % 10),
+					'\0'};
+	u8g2.drawStr(x, 30, text);
+}
+
+// Sequencer setting shown above knobs 0-2 in rhythm mode, the mode by name, the tempo in BPM and the gate in percent
+static void drawRhythmSetting(U8G2 &u8g2, const DisplayState &state, uint8_t knob, uint8_t x) {
+	if (knob == 0) {
+		const char *modes[] = {"OFF", "UP", "DN", "RND", "SEQ"};
+		u8g2.drawStr(x, 30, modes[state.rhythm[0]]);
+		return;
+	}
+	if (knob == 2)
+		u8g2.drawStr(x, 30, "G");
+	u8g2.setCursor(knob == 2 ? x + 6 : x, 30);
+	u8g2.print(knob == 2 ? state.rhythm[2] * 25 : state.rhythm[1]);
+}
+
+// FM setting shown above knobs 0-2 in FM mode, the operators, depth and feedback each as a letter and the setting
+static void drawFMSetting(U8G2 &u8g2, const DisplayState &state, uint8_t knob, uint8_t x) {
+	const char labels[] = "OIF";
+	char text[4] = {labels[knob], (char)('0' + state.fm[knob] / 10), (char)('0' + state.fm[knob] % 10), '\0'};
+	u8g2.drawStr(x, 30, text);
+}
+
+// A widget is cleared and redrawn within its rectangle whenever changed() is true
+// Rectangles do not overlap, text rows are y 0-10, 11-20 and 21-31 for baselines at 10, 20 and 30
+struct Widget {
+	uint8_t x, y, w, h;
+	bool (*changed)(const DisplayState &shown, const DisplayState &state);
+	void (*draw)(U8G2 &u8g2, const DisplayState &state);
+};
+
+static const Widget widgets[] = {
+	{0, 0, 36, 11, // Currently selected note, struck through in secondary mode
+	 [](const DisplayState &shown, const DisplayState &state) {
+		 return shown.note != state.note || shown.secondary != state.secondary;
+	 },
+	 [](U8G2 &u8g2, const DisplayState &state) {
+		 u8g2.drawStr(2, 10, state.note);
+		 if (state.secondary)
+			 u8g2.drawHLine(1, 6, 26);
+	 }},
+	{36, 0, 92, 11, // Secondary or cluster mode label
+	 [](const DisplayState &shown, const DisplayState &state) {
+		 return shown.secondary != state.secondary || shown.clusterNodes != state.clusterNodes;
+	 },
+	 [](U8G2 &u8g2, const DisplayState &state) {
+		 if (state.secondary) {
+			 u8g2.drawStr(40, 10, "Secondary Mode");
+		 } else if (state.clusterNodes) {
+			 u8g2.drawStr(40, 10, "Cluster x");
+			 u8g2.setCursor(94, 10);
+			 u8g2.print(state.clusterNodes);
+		 }
+	 }},
+	{0, 11, 48, 10, // Key matrix state
+	 [](const DisplayState &shown, const DisplayState &state) {
+		 for (uint8_t i = 0; i < 7; i++)
+			 if (shown.keys[i] != state.keys[i])
+				 return true;
+		 return false;
+	 },
+	 [](U8G2 &u8g2, const DisplayState &state) {
+		 u8g2.setCursor(2, 20);
+		 for (uint8_t i = 0; i < 7; i++)
+			 u8g2.print(state.keys[i], HEX);
+	 }},
+	{0, 21, 34, 11, // Current octave above knob 0
+	 [](const DisplayState &shown, const DisplayState &state) {
+		 return shown.octave != state.octave || shown.envelopeMode != state.envelopeMode ||
+				shown.envelope[0] != state.envelope[0] ||
+				shown.filterMode != state.filterMode || shown.filter[0] != state.filter[0] ||
+				shown.rhythmMode != state.rhythmMode || shown.rhythm[0] != state.rhythm[0] ||
+				shown.fmMode != state.fmMode || shown.fm[0] != state.fm[0];
+	 },
+	 [](U8G2 &u8g2, const DisplayState &state) {
+		 if (state.envelopeMode) {
+			 drawEnvelopeSetting(u8g2, state, 0, 2);
+			 return;
+		 }
+		 if (state.filterMode) {
+			 drawFilterSetting(u8g2, state, 0, 2);
+			 return;
+		 }
+		 if (state.rhythmMode) {
+			 drawRhythmSetting(u8g2, state, 0, 2);
+			 return;
+		 }
+		 if (state.fmMode) {
+			 drawFMSetting(u8g2, state, 0, 2);
+			 return;
+		 }
+		 u8g2.drawStr(2, 30, "O:");
+		 u8g2.setCursor(14, 30);
+		 u8g2.print(state.octave);
+	 }},
+	{34, 21, 24, 11, // Selected waveform above knob 1, struck through in secondary mode
+	 [](const DisplayState &shown, const DisplayState &state) {
+		 return shown.waveform != state.waveform || shown.secondary != state.secondary ||
+				shown.envelopeMode != state.envelopeMode || shown.envelope[1] != state.envelope[1] ||
+				shown.filterMode != state.filterMode || shown.filter[1] != state.filter[1] ||
+				shown.rhythmMode != state.rhythmMode || shown.rhythm[1] != state.rhythm[1] ||
+				shown.fmMode != state.fmMode || shown.fm[1] != state.fm[1];
+	 },
+	 [](U8G2 &u8g2, const DisplayState &state) {
+		 if (state.envelopeMode) {
+			 drawEnvelopeSetting(u8g2, state, 1, 36);
+			 return;
+		 }
+		 if (state.filterMode) {
+			 drawFilterSetting(u8g2, state, 1, 36);
+			 return;
+		 }
+		 if (state.rhythmMode) {
+			 drawRhythmSetting(u8g2, state, 1, 36);
+			 return;
+		 }
+		 if (state.fmMode) {
+			 drawFMSetting(u8g2, state, 1, 36);
+			 return;
+		 }
+		 u8g2.drawXBM(38, 22, 13, 9, waveforms[state.waveform]);
+		 if (state.secondary)
+			 u8g2.drawHLine(36, 26, 18);
+	 }},
+	{72, 21, 30, 11, // Send / Receive state above knob 2
+	 [](const DisplayState &shown, const DisplayState &state) {
+		 return shown.send != state.send || shown.envelopeMode != state.envelopeMode ||
+				shown.envelope[2] != state.envelope[2] ||
+				shown.filterMode != state.filterMode || shown.filter[2] != state.filter[2] ||
+				shown.rhythmMode != state.rhythmMode || shown.rhythm[2] != state.rhythm[2] ||
+				shown.fmMode != state.fmMode || shown.fm[2] != state.fm[2];
+	 },
+	 [](U8G2 &u8g2, const DisplayState &state) {
+		 if (state.envelopeMode) {
+			 drawEnvelopeSetting(u8g2, state, 2, 74);
+			 return;
+		 }
+		 if (state.filterMode) {
+			 drawFilterSetting(u8g2, state, 2, 74);
+			 return;
+		 }
+		 if (state.rhythmMode) {
+			 drawRhythmSetting(u8g2, state, 2, 74);
+			 return;
+		 }
+		 if (state.fmMode) {
+			 drawFMSetting(u8g2, state, 2, 74);
+			 return;
+		 }
+		 u8g2.drawStr(74, 30, state.send ? "SEND" : "RECV");
+	 }},
+	{108, 21, 20, 11, // Volume indicator above knob 3, struck through in secondary mode
+	 [](const DisplayState &shown, const DisplayState &state) {
+		 return shown.volume != state.volume || shown.volumeFiner != state.volumeFiner ||
+				shown.secondary != state.secondary || shown.envelopeMode != state.envelopeMode ||
+				shown.envelope[3] != state.envelope[3];
+	 },
+	 [](U8G2 &u8g2, const DisplayState &state) {
+		 if (state.envelopeMode) {
+			 drawEnvelopeSetting(u8g2, state, 3, 110);
+			 return;
+		 }
+		 if (!state.volumeFiner) {
+			 u8g2.drawXBM(112, 22, 13, 9, volumes[state.volume]);
+		 } else {
+			 u8g2.setCursor(117, 30);
+			 u8g2.print(state.volume);
+		 }
+		 if (state.secondary)
+			 u8g2.drawHLine(110, 26, 16);
+	 }},
+};
+
+static const uint8_t tileColumns = 16; // 128 / 8
+static const uint8_t tileRows = 4;	   // 32 / 8
+
+DisplayUI::DisplayUI() {
+	DisplayUI::valid = false;
+}
+
+void DisplayUI::invalidate() {
+	valid = false;
+}
+
+uint32_t DisplayUI::update(U8G2 &u8g2, const DisplayState &state) {
+	uint16_t dirtyTiles[tileRows] = {0}; // Bit n of row r is tile (n, r)
+	bool dirty = false;
+	u8g2.setFont(u8g2_font_profont12_mf);
+	for (const Widget &widget : widgets) {
+		if (valid && !widget.changed(shown, state))
+			continue;
+		u8g2.setDrawColor(0);
+		u8g2.drawBox(widget.x, widget.y, widget.w, widget.h);
+		u8g2.setDrawColor(1);
+		widget.draw(u8g2, state);
+		uint8_t x0 = widget.x / 8, x1 = (widget.x + widget.w - 1) / 8;
+		uint16_t columns = ((0x1 << (x1 + 1)) - 1) & ~((0x1 << x0) - 1);
+		for (uint8_t r = widget.y / 8; r <= (widget.y + widget.h - 1) / 8; r++)
+			dirtyTiles[r] |= columns;
+		dirty = true;
+	}
+	shown = state;
+	valid = true;
+	if (!dirty)
+		return 0;
+	uint32_t tilesSent = 0;
+	for (uint8_t r = 0; r < tileRows; r++) { // Send each run of dirty tiles in a row with one transfer
+		uint8_t c = 0;
+		while (c < tileColumns) {
+			if (!(dirtyTiles[r] & (0x1 << c))) {
+				c++;
+				continue;
+			}
+			uint8_t start = c;
+			while (c < tileColumns && (dirtyTiles[r] & (0x1 << c)))
+				c++;
+			u8g2.updateDisplayArea(start, r, c - start, 1);
+			tilesSent += c - start;
+		}
+	}
+	return tilesSent;
+}
@@ -0,0 +1,312 @@
+// Microbenchmarks of the firmware's hot paths, compiled in only when ENABLE_BENCH is defined
+// Each is checked against two limits. Its budget is the time it was measured to take plus a margin, separately for
+// the host and the board, so a small regression fails it. Its ceiling is a share of the period its code runs in, in
+// cycles at 80MHz, picked so that passing them all leaves every deadline met, a looser gate that holds whatever the
+// budgets are
+// On the board, benchTask() runs them once after the scheduler starts and times them with the DWT cycle counter,
+// checking the max against the budget and the ceiling. On the host, src/native/bench.cpp runs them and times them in
+// ns, checking the median against the budget, scaled by how long a calibration loop takes compared to the host the
+// budgets were measured on, and against the ceiling at 80MHz divided by a speedup
+//
+// Host budgets are 2.5 times the fastest median of ten runs on a 2.1GHz Xeon, as the medians of one benchmark were
+// seen to vary by up to 2.1 times from run to run. Board budgets are estimates, not measurements, as no board was at
+// hand: the same host medians at 6 cycles per ns, taking the Cortex-M4 to need three cycles for each of the host's,
+// plus half again. The display's are the exception, see benchDisplay(). Replace them with the max from
+// nucleo_l432kc_bench plus a quarter once it has been run
+//
+// Results are printed as lines of comma separated values, in cycles on the board and ns on the host
+//   U,unitsPerSecond
+//   C,calibration,reference (host only, ns)
+//   M,name,variant,runs,min,median,max,budget,ceiling,PASS or FAIL
+//   S,benchmarks,failures
+// The board is checked on the max, as nothing else runs while benchTask() does, and the host on the median, so the
+// run is not failed by the host scheduling something else
+#ifdef ENABLE_BENCH
+
+#include <Arduino.h>
+#include <STM32FreeRTOS.h>
+#include <algorithm>
+#include <can_proto>
+#include <cstdio>
+#include <dac>
+#include <filter>
+#include <firmware.h>
+#include <knob>
+#include <synth>
+#include <tables>
+#include <ui>
+#ifdef NATIVE_BUILD
+#include <chrono>
+#endif
+
+const uint32_t benchRuns = 101;			// Timed runs of each benchmark, after one untimed run to warm the caches
+const uint32_t targetClock = 80000000;	// Ceilings are in cycles at the board's core clock
+const uint32_t blockCycles = (uint64_t)targetClock * blockSize / samplingRate; // One block period, 366667 cycles
+const uint32_t scanCycles = targetClock / 1000;								   // scanKeysTask() period
+const uint32_t displayCycles = (uint64_t)targetClock * displayInterval / 1000;  // displayUpdateTask() period
+const char *const waveformNames[] = {"square", "sawtooth", "triangle", "sine", "sample", "fm"};
+// The same tables as main.cpp's, which are internal to it
+constexpr Table<int32_t, numNotes> stepSizes = makeStepSizes(samplingRate, referenceA4);
+constexpr Table<int32_t, filterCutoffs> cutoffCos = makeCutoffTable<filterCutoffs>(samplingRate, 80, 6, true);
+constexpr Table<int32_t, filterCutoffs> cutoffSin = makeCutoffTable<filterCutoffs>(samplingRate, 80, 6, false);
+constexpr Table<int32_t, filterResonances> resonanceQ = makeGeometricTable<filterResonances>(0.7071, 1.2);
+
+#ifdef NATIVE_BUILD
+const uint32_t calibrationSteps = 100000;	 // Dependent multiply and adds in the calibration loop
+const uint32_t referenceCalibration = 143000; // ns the calibration loop took on the host the budgets were measured on
+#endif
+
+// Limit on a benchmark from its measured time plus a margin
+struct Budget {
+	uint32_t host;	 // ns of the median on the host
+	uint32_t target; // Cycles of the max on the board
+};
+
+static uint32_t times[benchRuns];
+static uint32_t speedup = 1;
+static uint32_t calibration = 1; // ns the calibration loop takes on this host
+static uint32_t benchmarks = 0;
+static uint32_t failures = 0;
+static int32_t benchLeft[blockSize];
+static int32_t benchRight[blockSize];
+
+static uint32_t benchTime() {
+#ifdef NATIVE_BUILD
+	return (uint32_t)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+#else
+	return DWT->CYCCNT;
+#endif
+}
+
+static uint32_t benchTimePerSecond() {
+#ifdef NATIVE_BUILD
+	return 1000000000;
+#else
+	return SystemCoreClock;
+#endif
+}
+
+// Time body benchRuns times, running prepare untimed before each, and print the result against its budget and a
+// ceiling in cycles
+template <typename Prepare, typename Body>
+static void measure(const char *name, const char *variant, Budget budget, uint32_t ceiling, Prepare prepare,
+					Body body) {
+	prepare(benchRuns);
+	body(benchRuns);
+	for (uint32_t run = 0; run < benchRuns; run++) {
+		prepare(run);
+		uint32_t start = benchTime();
+		body(run);
+		times[run] = benchTime() - start;
+	}
+	std::sort(times, times + benchRuns);
+#ifdef NATIVE_BUILD
+	uint32_t checked = times[benchRuns / 2];
+	uint32_t budgetLimit = (uint64_t)budget.host * calibration / referenceCalibration;
+	uint32_t limit = (uint64_t)ceiling * 1000000000 / targetClock / speedup;
+#else
+	uint32_t checked = times[benchRuns - 1];
+	uint32_t budgetLimit = budget.target;
+	uint32_t limit = ceiling;
+#endif
+	bool pass = checked <= budgetLimit && checked <= limit;
+	benchmarks++;
+	if (!pass)
+		failures++;
+	char line[112];
+	snprintf(line, sizeof(line), "M,%s,%s,%u,%u,%u,%u,%u,%u,%s", name, variant, (unsigned)benchRuns,
+			 (unsigned)times[0], (unsigned)times[benchRuns / 2], (unsigned)times[benchRuns - 1], (unsigned)budgetLimit,
+			 (unsigned)limit, pass ? "PASS" : "FAIL");
+	Serial.println(line);
+}
+
+static void nothing(uint32_t run) {}
+
+#ifdef NATIVE_BUILD
+// Median time of a fixed chain of dependent integer multiply and adds, which the host budgets are scaled by
+static uint32_t calibrate() {
+	static volatile uint32_t sink;
+	for (uint32_t run = 0; run <= benchRuns; run++) {
+		uint32_t value = sink;
+		uint32_t start = benchTime();
+		for (uint32_t i = 0; i < calibrationSteps; i++)
+			value = value * 1664525 + 1013904223;
+		uint32_t time = benchTime() - start;
+		sink = value;
+		if (run) // The first warms up
+			times[run - 1] = time;
+	}
+	std::sort(times, times + benchRuns);
+	return times[benchRuns / 2];
+}
+#endif
+
+// Start voices notes a fourth apart from C2 upwards, held until allNotesOff()
+static void startVoices(uint8_t voices) {
+	synth.allNotesOff();
+	for (uint8_t i = 0; i < voices; i++)
+		synth.noteOn(13 + i * 5, stepSizes[13 + i * 5]);
+}
+
+// The voice pool's kernels for every waveform, at 1, 4 and a full pool of voices, FM with all its operators
+// Ceiling: a full pool within half the block period, leaving the rest for the filter, output stage and other tasks,
+// pro rata for fewer voices, plus a fiftieth of the period for the per block overhead
+static void benchRenderBlock() {
+	const uint8_t voiceCounts[] = {1, 4, Synth::numVoices};
+	static const Budget budgets[][3] = {
+		{{2500, 8800}, {5800, 21000}, {15000, 53000}}, // square
+		{{2500, 8800}, {5800, 21000}, {15000, 53000}}, // sawtooth
+		{{2500, 8900}, {5800, 21000}, {15000, 53000}}, // triangle
+		{{2500, 9000}, {5800, 21000}, {15000, 54000}}, // sine
+		{{2900, 11000}, {7600, 28000}, {39000, 140000}}, // sample
+		{{6400, 23000}, {23000, 80000}, {65000, 240000}}, // fm
+	};
+	synth.setFM(Synth::maxOperators, (fmDepths - 1) * fmDepthStep, (fmFeedbacks - 1) * fmFeedbackStep);
+	for (uint8_t waveform = SQUARE; waveform <= FM; waveform++) {
+		for (uint8_t i = 0; i < 3; i++) {
+			const uint8_t voices = voiceCounts[i];
+			char variant[24];
+			snprintf(variant, sizeof(variant), "%s/%u", waveformNames[waveform], (unsigned)voices);
+			synth.setWaveform(waveform);
+			startVoices(voices);
+			measure("Synth::renderBlock", variant, budgets[waveform][i],
+					blockCycles / 2 * voices / Synth::numVoices + blockCycles / 50, nothing,
+					[](uint32_t run) { synth.renderBlock(benchLeft, benchRight, blockSize); });
+		}
+	}
+	synth.allNotesOff();
+}
+
+// A whole block as renderTask() renders it, with no voices to time the block overhead and output stage, and with a
+// full pool through the resonant low pass filter for the worst case
+// Ceiling: half the block period, and a twentieth of it for the overhead alone
+static void benchRenderNextBlock() {
+	synth.allNotesOff();
+	publishControls();
+	measure("renderNextBlock", "idle", {2100, 7500}, blockCycles / 20, nothing, [](uint32_t run) { renderNextBlock(); });
+	KT.setRotation(FILTER_LOWPASS);
+	KQ.setRotation(filterResonances - 1);
+	publishControls();
+	startVoices(Synth::numVoices);
+	measure("renderNextBlock", "full/lowpass", {23000, 81000}, blockCycles / 2, nothing, [](uint32_t run) { renderNextBlock(); });
+	KT.setRotation(FILTER_OFF);
+	KQ.setRotation(0);
+	publishControls();
+	synth.allNotesOff();
+	renderNextBlock(); // Take the restored controls
+}
+
+// The filter alone, over one mono block at its highest resonance
+// Ceiling: a fortieth of the block period, a small part of what is left beside the voices
+static void benchFilter() {
+	Filter bench;
+	bench.setCoefficients(FILTER_LOWPASS, cutoffCos[filterCutoffs / 2], cutoffSin[filterCutoffs / 2],
+						  resonanceQ[filterResonances - 1]);
+	for (uint32_t i = 0; i < blockSize; i++)
+		benchLeft[i] = (i & 32) ? 8000 : -8000;
+	measure("Filter::process", "lowpass", {3700, 14000}, blockCycles / 40, nothing,
+			[&bench](uint32_t run) { bench.process(benchLeft, blockSize, 0); });
+}
+
+// Decoding all four knobs from one scan and applying their detents, as scanKeysTask() does every 1ms, with every knob
+// moving one Gray code state clockwise on each scan
+// Ceiling: a hundredth of the scan period
+static void benchKnobs() {
+	static const uint8_t gray[4] = {0, 1, 3, 2};
+	static KnobBank bank;
+	static Knob knobs[KnobBank::numKnobs] = {Knob(0, 100), Knob(0, 100), Knob(0, 100), Knob(0, 100)};
+	static uint32_t matrix;
+	measure(
+		"KnobBank::update", "turning", {130, 460}, scanCycles / 100,
+		[](uint32_t run) {
+			uint32_t state = gray[run & 3];
+			matrix = (state | state << 2 | state << 4 | state << 6) << 12;
+		},
+		[](uint32_t run) {
+			bank.update(matrix, run);
+			for (uint8_t k = 0; k < KnobBank::numKnobs; k++)
+				knobs[k].turn(bank.takeSteps(k), bank.getAcceleration(k));
+		});
+}
+
+// Key messages, on their own and on the way from scanKeysTask() through decodeTask() to the voice pool, alternately
+// pressing and releasing a key so the pool does not fill up
+// Ceiling: a hundredth of the scan period to encode or decode a message, a tenth to play it
+static void benchKeyMessages() {
+	static uint8_t message[8];
+	static uint16_t state;
+	measure(
+		"encodeKeysMessage", "1 key", {73, 270}, scanCycles / 100, [](uint32_t run) { state = (run & 1) ? 0 : 1 << 9; },
+		[](uint32_t run) { encodeKeysMessage(message, 4, state, 1 << 9, run, 0x10); });
+	measure(
+		"decodeMessage", "MSG_KEYS", {170, 610}, scanCycles / 100,
+		[](uint32_t run) { encodeKeysMessage(message, 4, (run & 1) ? 0 : 1 << 9, 1 << 9, run, 0x10); },
+		[](uint32_t run) { decodeMessage(message); });
+	measure(
+		"keysChangedSendTXMessage", "to decodePending", {260, 920}, scanCycles / 10,
+		[](uint32_t run) { state = (run & 1) ? 0 : 1 << 9; },
+		[](uint32_t run) {
+			keysChangedSendTXMessage(4, state, 1 << 9);
+			decodePending();
+		});
+	synth.allNotesOff();
+}
+
+// Composing a frame of the display and sending the tiles that changed, with only the pressed keys changing, and
+// with every widget redrawn as on the first frame. On the host nothing is sent, so only composing is timed
+// Ceiling: a tenth of the display period, and half of it for a full redraw, as the I2C transfer dominates on the board
+// Board budget: the 17.01ms measured by hand for sending a whole frame, and 12 of its 64 tiles for the keys, plus a
+// quarter
+static void benchDisplay() {
+	static DisplayState state = {};
+	state.note = "C";
+	state.octave = 4;
+	state.waveform = SINE;
+	state.volume = 4;
+	measure(
+		"DisplayUI::update", "keys", {1100, 320000}, displayCycles / 10, [](uint32_t run) { state.keys[0] = run & 0xF; },
+		[](uint32_t run) { ui.update(u8g2, state); });
+	measure(
+		"DisplayUI::update", "full", {1200, 1700000}, displayCycles / 2, [](uint32_t run) { ui.invalidate(); },
+		[](uint32_t run) { ui.update(u8g2, state); });
+	ui.invalidate(); // Redraw from the real state on the next frame
+}
+
+uint32_t runBenchmarks(uint32_t hostSpeedup) {
+	speedup = hostSpeedup;
+	benchmarks = failures = 0;
+	char line[32];
+	snprintf(line, sizeof(line), "U,%u", (unsigned)benchTimePerSecond());
+	Serial.println(line);
+#ifdef NATIVE_BUILD
+	calibration = calibrate();
+	snprintf(line, sizeof(line), "C,%u,%u", (unsigned)calibration, (unsigned)referenceCalibration);
+	Serial.println(line);
+#endif
+	benchRenderBlock();
+	benchRenderNextBlock();
+	benchFilter();
+	benchKnobs();
+	benchKeyMessages();
+	benchDisplay();
+	snprintf(line, sizeof(line), "S,%u,%u", (unsigned)benchmarks, (unsigned)failures);
+	Serial.println(line);
+	return failures;
+}
+
+// Task that runs the benchmarks once on the board, above every other task so none of them runs in between, then
+// deletes itself. The sample timer is stopped meanwhile, as renderNextBlock() is timed into the halves of dacBuffer
+// being played. Never run on the host, which has no scheduler
+void benchTask(void *pvParameters) {
+#ifndef NATIVE_BUILD
+	CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk; // Enable the DWT cycle counter
+	DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+#endif
+	DAC_Stop();
+	runBenchmarks(1);
+	bufferReady = true; // Not an underrun
+	DAC_Start();
+	vTaskDelete(nullptr);
+}
+
+#endif
@@ -2,91 +2,110 @@
 #include <STM32FreeRTOS.h>
 #include <U8g2lib.h>
 #include <atomic>
+#include <can_proto>
+#include <cluster>
+#include <dac>
 #include <es_can>
+#include <filter>
+#include <firmware.h>
+#include <joystick>
+#include <keyscan>
 #include <knob>
+#include <midi>
+#include <ring>
+#include <sequencer>
 #include <string>
+#include <synth>
+#include <tables>
+#include <trace>
+#include <ui>
 
 #pragma region Globals(Config values, Variables, Objects, Types, etc.)
-// Config values
-const uint32_t interval = 10;		 // Display update interval
-const uint32_t samplingRate = 48000; // Sampling rate
-const uint32_t canID = 0x123;
+// Config values in firmware.h
 // Variables
 std::atomic<bool> isMainSynth;
-std::atomic<int32_t> currentStepSize;
 std::atomic<uint8_t> keyArray[7];
 std::atomic<uint8_t> octave;
 std::atomic<uint8_t> selectedWaveform;
 std::atomic<int> latestKey;
 std::atomic<int8_t> volume;
 std::atomic<bool> volumeFiner;
+std::atomic<bool> envelopeMode; // Knobs set the envelope instead of octave, waveform, mode and volume
+std::atomic<bool> filterMode;	// Knobs 0-2 set the filter type, cutoff and resonance instead of octave, waveform and mode
+std::atomic<bool> rhythmMode;	// Knobs 0-2 set the sequencer mode, tempo and gate instead of octave, waveform and mode
+std::atomic<bool> fmMode;		// Knobs 0-2 set the FM operators, depth and feedback instead of octave, waveform and mode
+std::atomic<bool> clusterMode;	// Main synth spreads notes over the voice pools of every board
+uint8_t nodeID;					// Identifies this board in cluster messages, from the unique device ID
 std::atomic<bool> handshakeEastOut;
 std::atomic<bool> handshakeWestOut;
-int8_t volumeHistory = 0;
-QueueHandle_t msgInQ;
-std::atomic<bool> bufferAactive;
-int32_t bufferA[220];
-int32_t bufferB[220];
+QueueHandle_t msgInQ; // Messages from this board's own keys, when it is the main synth
+SPSCRing<CANFrame, 32> rxRing; // Messages received over CAN, filled by CAN_RX_ISR() and emptied by decodeTask()
+QueueHandle_t msgOutQ;
+SemaphoreHandle_t CAN_TX_Semaphore; // Counts free transmit mailboxes
+BusStats busStats;
+std::atomic<bool> bufferAactive; // Half of dacBuffer currently being played by DMA, the other is rendered into
+std::atomic<bool> bufferReady;	 // Set by renderTask() once the inactive half is filled
+std::atomic<uint32_t> underrunCount;
+std::atomic<bool> audioParked;	   // Set by renderTask() once it has stopped the sample timer after idleHoldoff of silence
+std::atomic<uint32_t> parkCount;   // Times the sample timer has been parked
+std::atomic<uint32_t> parkedTime;  // ms spent parked, not counting the current park
+std::atomic<uint32_t> parkedSince; // millis() when the current park began
+uint16_t dacBuffer[2 * blockSize]; // Halves A and B of packed DAC samples, right in bits 0-7 and left in bits 8-15
+int32_t mixLeft[blockSize];		   // Synth output, the only mix in mono
+int32_t mixRight[blockSize];
+int32_t outputGain;				   // Output gain at the end of the last block, which the next block ramps from
+TaskHandle_t renderHandle = nullptr;
+TaskHandle_t scanKeysHandle = nullptr;
+TaskHandle_t CAN_TX_Handle = nullptr;
+TaskHandle_t decodeHandle = nullptr;
+TaskHandle_t displayUpdateHandle = nullptr;
 // Objects
 U8G2_SSD1305_128X32_NONAME_F_HW_I2C u8g2(U8G2_R0); // Display Driver Object
 Knob K0(1, 7, 4);								   // Octave Knob Object
-Knob K1(0, 3, 2);								   // Waveform Knob Object
+Knob K1(0, FM, 2);								   // Waveform Knob Object
 Knob K2(0, 1);									   // Send / Receive Knob Object
-Knob K3(0, 16, 2);								   // Volume Knob Object
+Knob K3(0, 5, 1);								   // Volume Knob Object
+Knob KA(0, envelopeSettings - 1, 1);			   // Attack Knob Object, knob 0 in envelope mode
+Knob KD(0, envelopeSettings - 1, 8);			   // Decay Knob Object, knob 1 in envelope mode
+Knob KS(0, envelopeSettings - 1, 15);			   // Sustain Knob Object, knob 2 in envelope mode
+Knob KR(0, envelopeSettings - 1, 4);			   // Release Knob Object, knob 3 in envelope mode
+Knob KT(FILTER_OFF, FILTER_BANDPASS);			   // Filter Type Knob Object, knob 0 in filter mode
+Knob KC(0, filterCutoffs - 1, filterCutoffs - 1);  // Filter Cutoff Knob Object, knob 1 in filter mode
+Knob KQ(0, filterResonances - 1);				   // Filter Resonance Knob Object, knob 2 in filter mode
+Knob KM(SEQ_OFF, SEQ_PATTERN);					   // Sequencer Mode Knob Object, knob 0 in rhythm mode
+Knob KB(0, sequencerTempos - 1, 16);			   // Sequencer Tempo Knob Object, knob 1 in rhythm mode
+Knob KG(1, Sequencer::gateQuarters, 2);			   // Sequencer Gate Knob Object, knob 2 in rhythm mode
+Knob KO(2, Synth::maxOperators, 2);				   // FM Operators Knob Object, knob 0 in FM mode
+Knob KI(0, fmDepths - 1, 6);					   // FM Depth Knob Object, knob 1 in FM mode
+Knob KF(0, fmFeedbacks - 1, 0);					   // FM Feedback Knob Object, knob 2 in FM mode
+Synth synth;									   // Polyphonic Voice Pool Object
+Filter filter;									   // Output Filter Object
+Sequencer sequencer(samplingRate);				   // Arpeggiator and Step Sequencer Object
+Seqlock<Controls> controls;						   // Knob Settings Snapshot for the Render Task
+KeyDebouncer keys(~knobRowsMask);				   // Key Matrix Debouncer Object
+KnobBank knobs;									   // Knob Quadrature Decoder Object
+KeysDecoder keysDecoder;						   // Received Key State Tracking Object
+KeysEncoder keysEncoder;						   // Sent Key Message Numbering Object, only used by scanKeysTask()
+MainElection election;							   // Main Synth Announcement Race Object
+MidiParser midiParser;							   // Received MIDI Byte Parser Object
+DisplayUI ui;									   // Display Widgets Object
+VoiceScheduler scheduler(Synth::numVoices, 3 * loadReportInterval); // Cluster Note Assignment Object
+JoystickControl joystick(vibratoRate * blockSize / samplingRate * 4294967296.0); // Pitch Bend and Vibrato Object
 // Program Specific Structures
-const int32_t stepSizes[85] = {0, 2926231, 3100234, 3284584, 3479896, 3686821, 3906050, 4138317, 4384394, 4645103, 4921316, 5213953, 5523990, 5852464, 6200470, 6569169, 6959792, 7373643, 7812102, 8276634, 8768788, 9290207, 9842633, 10427906, 11047981, 11704929, 12400940, 13138339, 13919585, 14747287, 15624206, 16553269, 17537578, 18580416, 19685266, 20855813, 22095964, 23409858, 24801881, 26276678, 27839170, 29494574, 31248412, 33106539, 35075157, 37160834, 39370533, 41711626, 44191929, 46819717, 49603763, 52553357, 55678341, 58989148, 62496825, 66213080, 70150315, 74321670, 78741066, 83423254, 88383859, 93639436, 99207527, 105106714, 111356684, 117978298, 124993652, 132426161, 140300631, 148643340, 157482133, 166846508, 176767718, 187278873, 198415055, 210213428, 222713369, 235956596, 249987305, 264852323, 280601262, 297286682, 314964268, 333693018, 353535437};
-const char *notes[85] = {"None", "C1", "C1#", "D1", "D1#", "E1", "F1", "F1#", "G1", "G1#", "A1", "A1#", "B1", "C2", "C2#", "D2", "D2#", "E2", "F2", "F2#", "G2", "G2#", "A2", "A2#", "B2", "C3", "C3#", "D3", "D3#", "E3", "F3", "F3#", "G3", "G3#", "A3", "A3#", "B3", "C4", "C4#", "D4", "D4#", "E4", "F4", "F4#", "G4", "G4#", "A4", "A4#", "B4", "C5", "C5#", "D5", "D5#", "E5", "F5", "F5#", "G5", "G5#", "A5", "A5#", "B5", "C6", "C6#", "D6", "D6#", "E6", "F6", "F6#", "G6", "G6#", "A6", "A6#", "B6", "C7", "C7#", "D7", "D7#", "E7", "F7", "F7#", "G7", "G7#", "A7", "A7#", "B7"};
-std::atomic<bool> activeNotes[85] = {{0}};
-enum waveform {
-	SQUARE = 0,
-	SAWTOOTH,
-	TRIANGLE,
-	SINE
-};
-const unsigned char waveforms[4][18] = {
-	{0x7f, 0x10, 0x41, 0x10, 0x41, 0x10, 0x41, 0x10, 0x41,
-	 0x10, 0x41, 0x10, 0x41, 0x10, 0x41, 0x10, 0xc1, 0x1f}, // Square Wave
-	{0x70, 0x10, 0x58, 0x18, 0x48, 0x08, 0x4c, 0x0c, 0x44,
-	 0x04, 0x46, 0x06, 0x42, 0x02, 0x43, 0x03, 0xc1, 0x01}, // Sawtooth Wave
-	{0x08, 0x00, 0x1c, 0x00, 0x36, 0x00, 0x63, 0x00, 0xc1,
-	 0x00, 0x80, 0x11, 0x00, 0x1b, 0x00, 0x0e, 0x00, 0x04}, // Triangle Wave
-	{0x1c, 0x00, 0x36, 0x00, 0x22, 0x00, 0x63, 0x00, 0x41,
-	 0x10, 0xc0, 0x18, 0x80, 0x08, 0x80, 0x0d, 0x00, 0x07} // Sine Wave
-};
-const unsigned char volumes[6][18] = {
-	{0x10, 0x00, 0x18, 0x00, 0x5c, 0x04, 0x9f, 0x02, 0x1f,
-	 0x01, 0x9f, 0x02, 0x5c, 0x04, 0x18, 0x00, 0x10, 0x00}, // mute
-	{0x10, 0x00, 0x18, 0x00, 0x1c, 0x00, 0x1f, 0x00, 0x5f,
-	 0x00, 0x1f, 0x00, 0x1c, 0x00, 0x18, 0x00, 0x10, 0x00}, // volume lowest
-	{0x10, 0x00, 0x18, 0x00, 0x1c, 0x00, 0x5f, 0x00, 0x5f,
-	 0x00, 0x5f, 0x00, 0x1c, 0x00, 0x18, 0x00, 0x10, 0x00}, // volume low
-	{0x10, 0x00, 0x18, 0x00, 0x1c, 0x01, 0x5f, 0x01, 0x5f,
-	 0x01, 0x5f, 0x01, 0x1c, 0x01, 0x18, 0x00, 0x10, 0x00}, // volume mid lower
-	{0x10, 0x00, 0x98, 0x00, 0x1c, 0x01, 0x5f, 0x01, 0x5f,
-	 0x01, 0x5f, 0x01, 0x1c, 0x01, 0x98, 0x00, 0x10, 0x00}, // volume mid higher
-	{0x10, 0x02, 0x98, 0x04, 0x1c, 0x05, 0x5f, 0x09, 0x5f,
-	 0x09, 0x5f, 0x09, 0x1c, 0x05, 0x98, 0x04, 0x10, 0x02}, // volume max
-};
+constexpr Table<int32_t, numNotes> stepSizes = makeStepSizes(samplingRate, referenceA4);
+constexpr Table<NoteName, numNotes> notes = makeNoteNames();
+constexpr Table<int32_t, filterCutoffs> cutoffCos = makeCutoffTable<filterCutoffs>(samplingRate, 80, 6, true);
+constexpr Table<int32_t, filterCutoffs> cutoffSin = makeCutoffTable<filterCutoffs>(samplingRate, 80, 6, false);
+constexpr Table<int32_t, filterResonances> resonanceQ = makeGeometricTable<filterResonances>(0.7071, 1.2);
+// Envelope segment times from instant, then 5ms up to 3.7s in steps of 1.6x
+// The attack aims at 1.5x full level, which it reaches after ln(3) time constants, decay and release take 4 time constants
+constexpr double controlRate = (double)samplingRate / blockSize;
+constexpr Table<int32_t, envelopeSettings> attackCoefficients = makeEnvelopeCoefficients<envelopeSettings>(controlRate, 0.005, 1.6, 1.0986);
+constexpr Table<int32_t, envelopeSettings> decayCoefficients = makeEnvelopeCoefficients<envelopeSettings>(controlRate, 0.005, 1.6, 4.0);
+std::atomic<bool> activeNotes[numNotes] = {{0}};
 const unsigned char icon_bits[] = {
 	0x00, 0x00, 0x00, 0x00, 0xcc, 0x00, 0xcc, 0x00, 0x00, 0x00,
 	0x00, 0x00, 0x02, 0x01, 0x02, 0x01, 0xfe, 0x01, 0x00, 0x00};
-const int8_t sinLUT[256] = {
-	0, 3, 6, 9, 12, 15, 18, 21, 24, 28, 31, 34, 37, 40, 43, 46,
-	48, 51, 54, 57, 60, 63, 65, 68, 71, 73, 76, 78, 81, 83, 85, 88,
-	90, 92, 94, 96, 98, 100, 102, 104, 106, 108, 109, 111, 112, 114, 115, 117,
-	118, 119, 120, 121, 122, 123, 124, 124, 125, 126, 126, 127, 127, 127, 127, 127,
-	127, 127, 127, 127, 127, 127, 126, 126, 125, 124, 124, 123, 122, 121, 120, 119,
-	118, 117, 115, 114, 112, 111, 109, 108, 106, 104, 102, 100, 98, 96, 94, 92,
-	90, 88, 85, 83, 81, 78, 76, 73, 71, 68, 65, 63, 60, 57, 54, 51,
-	48, 46, 43, 40, 37, 34, 31, 28, 24, 21, 18, 15, 12, 9, 6, 3,
-	0, -4, -7, -10, -13, -16, -19, -22, -25, -29, -32, -35, -38, -41, -44, -47,
-	-49, -52, -55, -58, -61, -64, -66, -69, -72, -74, -77, -79, -82, -84, -86, -89,
-	-91, -93, -95, -97, -99, -101, -103, -105, -107, -109, -110, -112, -113, -115, -116, -118,
-	-119, -120, -121, -122, -123, -124, -125, -125, -126, -127, -127, -128, -128, -128, -128, -128,
-	-128, -128, -128, -128, -128, -128, -127, -127, -126, -125, -125, -124, -123, -122, -121, -120,
-	-119, -118, -116, -115, -113, -112, -110, -109, -107, -105, -103, -101, -99, -97, -95, -93,
-	-91, -89, -86, -84, -82, -79, -77, -74, -72, -69, -66, -64, -61, -58, -55, -52,
-	-49, -47, -44, -41, -38, -35, -32, -29, -25, -22, -19, -16, -13, -10, -7, -4};
 #pragma endregion
 
 #pragma region Pin Definitions
@@ -114,6 +133,21 @@ const int HKOW_BIT = 5;
 const int HKOE_BIT = 6;
 #pragma endregion
 
+// GPIO port and bit of a pin, looked up once so the key matrix can be scanned with direct register accesses
+struct PinRegister {
+	GPIO_TypeDef *port;
+	uint32_t mask;
+};
+PinRegister RA_REG[3], REN_REG, OUT_REG, C_REG[matrixColumns];
+
+PinRegister pinRegister(const int pin) {
+	return {digitalPinToPort(pin), digitalPinToBitMask(pin)};
+}
+
+inline void writePin(const PinRegister &pin, const bool value) {
+	pin.port->BSRR = value ? pin.mask : pin.mask << 16; // Upper half of BSRR resets the pin
+}
+
 // Function to set outputs using key matrix
 void setOutMuxBit(const uint8_t bitIdx, const bool value) {
 	digitalWrite(REN_PIN, LOW);
@@ -126,224 +160,816 @@ void setOutMuxBit(const uint8_t bitIdx, const bool value) {
 	digitalWrite(REN_PIN, LOW);
 }
 
-// Read key values in currently set row
+// Read key values in currently set row, keys are active low
 uint8_t readCols() {
 	uint8_t row = 0;
-	row |= !digitalRead(C0_PIN) << 0;
-	row |= !digitalRead(C1_PIN) << 1;
-	row |= !digitalRead(C2_PIN) << 2;
-	row |= !digitalRead(C3_PIN) << 3;
+	for (uint8_t j = 0; j < matrixColumns; j++)
+		row |= !(C_REG[j].port->IDR & C_REG[j].mask) << j;
 	return row;
 }
 
 // Set multiplexer bits to select row, and set output from multiplexer
 void setRow(const uint8_t rowIdx, const bool value) {
-	digitalWrite(REN_PIN, LOW);
-	digitalWrite(RA0_PIN, rowIdx & 0x01);
-	digitalWrite(RA1_PIN, rowIdx & 0x02);
-	digitalWrite(RA2_PIN, rowIdx & 0x04);
-	digitalWrite(OUT_PIN, value);
-	digitalWrite(REN_PIN, HIGH);
+	writePin(REN_REG, LOW);
+	writePin(RA_REG[0], rowIdx & 0x01);
+	writePin(RA_REG[1], rowIdx & 0x02);
+	writePin(RA_REG[2], rowIdx & 0x04);
+	writePin(OUT_REG, value);
+	writePin(REN_REG, HIGH);
 }
 
-// Scales output signal according to global volume value, to range 0-255
-uint32_t scaleVolume(uint32_t Vout) {
-	uint32_t newVout = 0;
-	if (volumeFiner) {
-		newVout = (Vout * 12 * volume) >> 16;
-	} else {								  // 25 = floor( (1/10) << 8 )
-		newVout = (Vout * 25 * volume) >> 16; // scale by 2*8 cuz 16-bit*8-bit=24-bit -> scale by 16 to get to 8
+// Output value for each row of the multiplexer while it is being scanned
+bool rowOutput(const uint8_t rowIdx) {
+	switch (rowIdx) {
+		case 3: // Display Power
+		case 4: // Display Reset, active low
+			return HIGH;
+		case 5: // Handshake Output West
+			return handshakeWestOut;
+		case 6: // Handshake Output East
+			return handshakeEastOut;
+		default: // Unimplemented
+			return LOW;
 	}
-	return newVout;
 }
 
-// Interrupt driven routine to send waveform to DAC
-void sampleISR() {
-	static int32_t phaseAcc = 0;
-	phaseAcc += currentStepSize;
-	int32_t Vout = 0;
-	if (selectedWaveform == SAWTOOTH) {
-		Vout = phaseAcc >> 16;
-	} else if (selectedWaveform == SQUARE) {
-		if (phaseAcc < 0) {
-			Vout = 0x00007FFF;
-		} else {
-			Vout = 0xFFFF8000;
+// Read the whole key matrix into one word, bit (row * 4 + column)
+uint32_t scanMatrix() {
+	uint32_t matrix = 0;
+	for (uint8_t i = 0; i < matrixRows; i++) {
+		setRow(i, rowOutput(i));
+		delayMicroseconds(3); // Settling time of the multiplexer and column pull-ups
+		matrix |= (uint32_t)readCols() << (i * matrixColumns);
+	}
+	return matrix;
+}
+
+// Gain of one volume knob step in 256ths of full scale, 10% for a coarse step
+int32_t volumeStep(bool finer) {
+	return finer ? 12 : 25;
+}
+
+// Q24 gain taking the signed 16-bit mix to the 8-bit DAC range at a volume knob setting
+int32_t volumeGain(int8_t volume, bool finer) {
+	return volumeStep(finer) * volume << 8;
+}
+
+// Function to queue a message for transmission without blocking, urgent messages skip ahead of the queue
+// Returns false, counting the message in busStats.txDropped, if the queue is full
+bool canSend(const uint8_t TX_Message[8], const bool urgent = false) {
+	BaseType_t queued = urgent ? xQueueSendToFront(msgOutQ, TX_Message, 0) : xQueueSend(msgOutQ, TX_Message, 0);
+	if (queued != pdPASS) {
+		busStats.txDropped++;
+		return false;
+	}
+	uint32_t waiting = uxQueueMessagesWaiting(msgOutQ);
+	if (waiting > busStats.txQueuePeak)
+		busStats.txQueuePeak = waiting;
+	return true;
+}
+
+// Interrupt service routine run by the DAC DMA each time it finishes playing half of dacBuffer
+// DMA moves on to the other half by itself, so this only hands the finished half to renderTask()
+void DAC_DMA_ISR(uint32_t half) {
+	TRACE_ENTER(TRACE_DAC_DMA_ISR);
+	if (!bufferReady) // Render did not finish in time, the half being played was not fully rendered
+		underrunCount++;
+	bufferReady = false;
+	bufferAactive = half == 1;
+	BaseType_t higherPriorityTaskWoken = pdFALSE;
+	vTaskNotifyGiveFromISR(renderHandle, &higherPriorityTaskWoken);
+	portYIELD_FROM_ISR(higherPriorityTaskWoken);
+	TRACE_EXIT(TRACE_DAC_DMA_ISR);
+}
+
+// Render the mix of a block in parts split at each sequencer event, so notes start and stop on the exact sample
+// Steps begun by the main synth are sent as clock messages once per beat, so other boards can follow them
+bool renderSequenced() {
+	bool stereo = false;
+	uint32_t done = 0;
+	while (true) {
+		uint32_t length = sequencer.untilEvent();
+		if (length > blockSize - done)
+			length = blockSize - done;
+		if (length) {
+			stereo |= synth.renderSegment(mixLeft + done, mixRight + done, done, length, blockSize);
+			sequencer.advance(length);
+			done += length;
+		}
+		if (done == blockSize)
+			return stereo;
+		uint8_t stop, start;
+		bool stepBegun = sequencer.fire(activeNotes, numNotes, stop, start);
+		if (stop) // No lock needed, decodeTask() cannot preempt renderTask()
+			synth.noteOff(stop);
+		if (start)
+			synth.noteOn(start, stepSizes[start]);
+		if (stepBegun && isMainSynth && sequencer.getStep() % clockInterval == 0) {
+			uint8_t TX_Message[8] = {MSG_CLOCK, (uint8_t)KB.getRotation(), sequencer.getStep(), nodeID};
+			canSend(TX_Message, true);
 		}
-	} else if (selectedWaveform == TRIANGLE) {
-		Vout = (abs(phaseAcc) - 1073741824) >> 15;
-	} else if (selectedWaveform == SINE) {
-		Vout = (sinLUT[(uint32_t)phaseAcc >> 24]) << 8;
 	}
-	Vout = scaleVolume(Vout);
-	analogWrite(OUTR_PIN, Vout + 128);
 }
 
-// Interrupt service routine that copies received CAN messages to (larger) internal buffer when available
-void CAN_RX_ISR() {
-	uint8_t ISR_RX_Message[8];
-	uint32_t ISR_rxID;
-	CAN_RX(ISR_rxID, ISR_RX_Message);
-	if (isMainSynth)
-		xQueueSendFromISR(msgInQ, ISR_RX_Message, nullptr);
+// Apply a snapshot of the knobs to the voice pool, filter and sequencer, only from renderTask() so nothing changes
+// during a block. The filter coefficients are only recomputed when its knobs have moved
+void applyControls(const Controls &applied) {
+	static int filterType = -1, filterCutoff = -1, filterResonance = -1;
+	if (applied.waveform != synth.getWaveform())
+		synth.setWaveform(applied.waveform);
+	synth.setEnvelope(applied.attack, applied.decay, applied.sustain, applied.release);
+	sequencer.setMode((SequencerMode)applied.sequencerMode);
+	sequencer.setTempo(applied.tempo);
+	sequencer.setGate(applied.gate);
+	synth.setFM(applied.operators, applied.fmDepth, applied.fmFeedback);
+	if (applied.filterType == filterType && applied.filterCutoff == filterCutoff &&
+		applied.filterResonance == filterResonance)
+		return;
+	filter.setCoefficients((FilterType)applied.filterType, cutoffCos[applied.filterCutoff],
+						   cutoffSin[applied.filterCutoff], resonanceQ[applied.filterResonance]);
+	filterType = applied.filterType;
+	filterCutoff = applied.filterCutoff;
+	filterResonance = applied.filterResonance;
 }
 
-// Task to update activeNotes[] and currentStepSize based on received CAN message
-void decodeTask(void *pvParameters) {
-	static uint8_t RX_Message[8] = {0};
+// Render the next block of samples into the half not being played, after applying the joystick and knobs at control
+// rate. A mono block is written to both channels, so either output alone plays every note
+// With the sequencer off the whole block is rendered at once, without checking for events
+// The output gain is ramped linearly from the last block's to the new one, so turning the volume does not zipper
+void renderNextBlock() {
+	static Controls current = {}; // Kept for another block if scanKeysTask() was part way through publishing
+	uint16_t *buffer = bufferAactive ? dacBuffer + blockSize : dacBuffer;
+	uint32_t joyX, joyY;
+	joystickRead(joyX, joyY); // Latest DMA readings, never waits for the ADC
+	joystick.update(joyX, joyY);
+	synth.setPitchFactor(joystick.getPitchFactor());
+	controls.read(current);
+	applyControls(current);
+	// No lock needed, decodeTask() cannot preempt renderTask()
+	bool stereo;
+	if (sequencer.getMode() == SEQ_OFF) {
+		if (uint8_t note = sequencer.stop())
+			synth.noteOff(note);
+		stereo = synth.renderBlock(mixLeft, mixRight, blockSize);
+	} else {
+		stereo = renderSequenced();
+	}
+	filter.process(mixLeft, blockSize, 0);
+	int32_t gain = outputGain;
+	const int32_t gainStep = (current.gain - gain) / (int32_t)blockSize;
+	if (stereo) {
+		filter.process(mixRight, blockSize, 1);
+		for (uint32_t i = 0; i < blockSize; i++) {
+			gain += gainStep;
+			buffer[i] = (((mixRight[i] * gain >> 24) + 128) & 0xFF) | (((mixLeft[i] * gain >> 24) + 128) & 0xFF) << 8;
+		}
+	} else {
+		for (uint32_t i = 0; i < blockSize; i++) {
+			gain += gainStep;
+			uint16_t value = ((mixLeft[i] * gain >> 24) + 128) & 0xFF;
+			buffer[i] = value | value << 8;
+		}
+	}
+	outputGain = current.gain; // Drops the remainder of the division
+	bufferReady = true;
+}
+
+// Stop the sample timer once nothing has sounded for idleHoldoff, counted from the end of the last release
+// Both halves of dacBuffer are silent by then, so the DAC holds the midpoint and there is no click. The filter is
+// cleared and the output gain faded in again on waking, so nothing left over from before the park is heard
+void parkWhenIdle() {
+	static uint32_t silentBlocks = 0;
+	if (synth.getActiveVoices() || sequencer.getMode() != SEQ_OFF) {
+		silentBlocks = 0;
+		return;
+	}
+	if (++silentBlocks < idleHoldoff * samplingRate / (1000 * blockSize) + 2)
+		return;
+	silentBlocks = 0;
+	DAC_Stop();
+	filter.reset();
+	outputGain = 0;
+	parkedSince = millis();
+	parkCount++;
+	audioParked = true;
+}
+
+// Render both halves of dacBuffer and restart the sample timer from the start of the buffer, so the note that woke
+// it is heard from the first sample played, rather than after up to a block of the old silence
+void resumeAudio() {
+	parkedTime += millis() - parkedSince;
+	bufferAactive = false; // Render half A, then half B as if A were playing
+	renderNextBlock();
+	bufferAactive = true;
+	renderNextBlock();
+	audioParked = false;
+	DAC_Start();
+}
+
+// Work done by renderTask() each time it is notified, by the DAC DMA or by audioWake()
+void renderPending() {
+	if (audioParked) {
+		resumeAudio();
+		return;
+	}
+	renderNextBlock();
+	parkWhenIdle();
+}
+
+// Restart the sample timer if it is parked, from any task that starts a note or the sequencer
+// renderTask() has the highest priority, so it has resumed by the time this returns
+void audioWake() {
+	if (!audioParked)
+		return;
+	bufferReady = false;
+	xTaskNotifyGive(renderHandle);
+}
+
+// Task to render a new block each time the DAC DMA finishes half of dacBuffer
+void renderTask(void *pvParameters) {
 	while (1) {
-		xQueueReceive(msgInQ, RX_Message, portMAX_DELAY);
-		if (RX_Message[0] == 0x50) { // Pressed
-			activeNotes[(RX_Message[1] - 1) * 12 + RX_Message[2]] = true;
-			latestKey = (RX_Message[1] - 1) * 12 + RX_Message[2];
-			currentStepSize = stepSizes[latestKey];
-		} else if (RX_Message[0] == 0x52) { // Released
-			activeNotes[(RX_Message[1] - 1) * 12 + RX_Message[2]] = false;
-			if (latestKey == (RX_Message[1] - 1) * 12 + RX_Message[2]) {
-				latestKey = 0;
-				currentStepSize = stepSizes[latestKey]; // Atomic Store
+		ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+		TRACE_ENTER(TRACE_RENDER);
+		renderPending();
+		TRACE_EXIT(TRACE_RENDER);
+	}
+}
+
+// Put a message into a transmit mailbox known to be free, so CAN_TX() never waits, and count it
+void transmitMessage(uint8_t TX_Message[8]) {
+	busStats.framesSent++;
+	busStats.bitsSent += canFrameBits(canBaseID | nodeID, TX_Message, 8);
+	CAN_TX(canBaseID | nodeID, TX_Message);
+}
+
+// Interrupt service routine run each time a transmit mailbox finishes sending
+// The next message waiting in msgOutQ goes straight into the freed mailbox, so the bus stays busy while messages are
+// queued, however long the tasks take. Only with nothing waiting is the mailbox released to CAN_TX_Task()
+void CAN_TX_ISR() {
+	TRACE_ENTER(TRACE_CAN_TX_ISR);
+	uint8_t TX_Message[8];
+	BaseType_t higherPriorityTaskWoken = pdFALSE;
+	if (xQueueReceiveFromISR(msgOutQ, TX_Message, &higherPriorityTaskWoken) == pdTRUE) {
+		transmitMessage(TX_Message);
+	} else {
+		xSemaphoreGiveFromISR(CAN_TX_Semaphore, &higherPriorityTaskWoken);
+	}
+	portYIELD_FROM_ISR(higherPriorityTaskWoken);
+	TRACE_EXIT(TRACE_CAN_TX_ISR);
+}
+
+// Move the next message in msgOutQ into a mailbox released by CAN_TX_ISR(), waiting up to wait ticks for each
+// Returns false if there was no free mailbox or no message
+bool transmitNextMessage(const TickType_t wait) {
+	uint8_t TX_Message[8];
+	if (xSemaphoreTake(CAN_TX_Semaphore, wait) != pdTRUE)
+		return false;
+	if (xQueueReceive(msgOutQ, TX_Message, wait) != pdTRUE) {
+		xSemaphoreGive(CAN_TX_Semaphore);
+		return false;
+	}
+	TRACE_ENTER(TRACE_CAN_TX);
+	taskENTER_CRITICAL(); // CAN_TX_ISR() also fills mailboxes and counts frames
+	transmitMessage(TX_Message);
+	taskEXIT_CRITICAL();
+	TRACE_EXIT(TRACE_CAN_TX);
+	return true;
+}
+
+// Task to start sending when the bus is idle, the first message after a pause goes through here and CAN_TX_ISR()
+// sends the rest while more are queued
+void CAN_TX_Task(void *pvParameters) {
+	while (1)
+		transmitNextMessage(portMAX_DELAY);
+}
+
+// Interrupt service routine that empties the CAN receive FIFO into rxRing, then wakes decodeTask()
+// Key messages are only kept by the main synth, the only board that plays them. Every other message is kept on every
+// board, as announcements, note assignments and clocks are what a secondary board follows, including the
+// announcement that puts it in cluster mode
+void CAN_RX_ISR() {
+	TRACE_ENTER(TRACE_CAN_RX_ISR);
+	bool received = false;
+	while (CAN_CheckRXLevel()) {
+		CANFrame frame;
+		CAN_RX(frame.ID, frame.data);
+		frame.time = micros();
+		busStats.framesReceived++;
+		busStats.bitsReceived += canFrameBits(frame.ID, frame.data, 8);
+		if (isMainSynth || frame.data[0] != MSG_KEYS)
+			received |= rxRing.push(frame);
+	}
+	if (received) {
+		BaseType_t higherPriorityTaskWoken = pdFALSE;
+		vTaskNotifyGiveFromISR(decodeHandle, &higherPriorityTaskWoken);
+		portYIELD_FROM_ISR(higherPriorityTaskWoken);
+	}
+	TRACE_EXIT(TRACE_CAN_RX_ISR);
+}
+
+// Interrupt service routine run at the end of each burst of MIDI bytes, wakes decodeTask() to parse them
+void MIDI_RX_ISR() {
+	BaseType_t higherPriorityTaskWoken = pdFALSE;
+	vTaskNotifyGiveFromISR(decodeHandle, &higherPriorityTaskWoken);
+	portYIELD_FROM_ISR(higherPriorityTaskWoken);
+}
+
+// Start or stop the voice of a note in this board's voice pool, and update latestKey
+void playNote(const uint8_t note, const bool pressed) {
+	if (note == 0 || note >= numNotes)
+		return;
+	taskENTER_CRITICAL(); // Voice pool is shared with renderTask()
+	if (pressed) {
+		synth.noteOn(note, stepSizes[note]);
+	} else {
+		synth.noteOff(note);
+	}
+	taskEXIT_CRITICAL();
+	if (pressed) {
+		audioWake();
+		latestKey = note;
+	} else if (latestKey == note) {
+		latestKey = 0;
+	}
+}
+
+// Update activeNotes[], and play the note on this board, or on the board chosen by the scheduler in cluster mode
+// While the sequencer is on it plays the held notes instead, so presses are not played but releases still are
+void noteChanged(const uint8_t note, const bool pressed) {
+	if (note == 0 || note >= numNotes)
+		return;
+	activeNotes[note] = pressed;
+	if (pressed && sequencer.getMode() != SEQ_OFF) {
+		latestKey = note;
+		return;
+	}
+	uint8_t node = nodeID;
+	if (clusterMode)
+		node = pressed ? scheduler.noteOn(note, synth.getActiveVoices()) : scheduler.noteOff(note);
+	if (node == nodeID || node == VoiceScheduler::noNode) {
+		playNote(note, pressed);
+		return;
+	}
+	uint8_t TX_Message[8] = {MSG_VOICE, node, note, pressed};
+	canSend(TX_Message);
+	if (pressed) {
+		latestKey = note;
+	} else if (latestKey == note) {
+		latestKey = 0;
+	}
+}
+
+// Record an announcement in the election, shared by scanKeysTask() and decodeTask(), and return true if it won
+bool electMainSynth(uint8_t node) {
+	taskENTER_CRITICAL();
+	bool won = election.announce(node, millis());
+	taskEXIT_CRITICAL();
+	return won;
+}
+
+// Switch to SEND mode, silencing the voices only the main synth plays
+void followMainSynth() {
+	isMainSynth = false;
+	K2.setRotation(1);
+	taskENTER_CRITICAL();
+	synth.allNotesOff();
+	taskEXIT_CRITICAL();
+}
+
+// Switch to SEND mode when another board announces itself as the main synth, unless this board or another with a
+// lower node ID announced itself moments before, in which case the announcing board gives way instead
+void mainSynthAnnounced(const uint8_t RX_Message[8]) {
+	if (RX_Message[2] == nodeID) // Our own announcement, received in loopback mode
+		return;
+	if (!electMainSynth(RX_Message[2]))
+		return;
+	clusterMode = RX_Message[1] == 1;
+	followMainSynth();
+}
+
+// Follow the tempo and step of the main synth's sequencer
+void clockReceived(const uint8_t RX_Message[8]) {
+	if (RX_Message[3] == nodeID) // Our own clock, received in loopback mode
+		return;
+	KB.setRotation(RX_Message[1]);
+	sequencer.sync(RX_Message[2]);
+}
+
+// Update activeNotes[] and the voice pool based on a received CAN message
+void decodeMessage(const uint8_t RX_Message[8]) {
+	if (!isMainSynth) { // Other boards only receive note assignments in cluster mode, and announcements
+		if (RX_Message[0] == MSG_VOICE && RX_Message[1] == nodeID) {
+			playNote(RX_Message[2], RX_Message[3]);
+		} else if (RX_Message[0] == MSG_ANNOUNCE) {
+			mainSynthAnnounced(RX_Message);
+		} else if (RX_Message[0] == MSG_CLOCK) {
+			clockReceived(RX_Message);
+		}
+		return;
+	}
+	if (RX_Message[0] == MSG_KEYS) {
+		uint8_t keysOctave;
+		uint16_t pressed;
+		uint16_t changed = keysDecoder.decode(RX_Message, keysOctave, pressed);
+		while (changed) {
+			uint8_t key = __builtin_ctz(changed);
+			changed &= changed - 1;
+			noteChanged((keysOctave - 1) * 12 + key + 1, pressed & (0x1 << key));
+		}
+	} else if (RX_Message[0] == MSG_PRESS) { // Single key messages from older firmware
+		noteChanged((RX_Message[1] - 1) * 12 + RX_Message[2], true);
+	} else if (RX_Message[0] == MSG_RELEASE) {
+		noteChanged((RX_Message[1] - 1) * 12 + RX_Message[2], false);
+	} else if (RX_Message[0] == MSG_LOAD) {
+		scheduler.report(RX_Message[1], RX_Message[2], RX_Message[3], millis());
+	} else if (RX_Message[0] == MSG_ANNOUNCE) { // Main Synth Announce
+		mainSynthAnnounced(RX_Message);
+	}
+}
+
+// Play or apply a MIDI message received on any channel, from decodeTask() like the CAN messages
+// Notes become single key messages, so a secondary board passes them on to the main synth
+void decodeMidiMessage(const MidiMessage &message) {
+	uint8_t type = message.status & 0xF0;
+	if (type == MIDI_NOTE_ON || type == MIDI_NOTE_OFF) {
+		int note = message.data1 - midiNoteOffset;
+		if (note < 1 || note >= numNotes)
+			return;
+		bool pressed = type == MIDI_NOTE_ON && message.data2; // Note on with velocity 0 is a note off
+		uint8_t TX_Message[8] = {pressed ? MSG_PRESS : MSG_RELEASE, (uint8_t)((note - 1) / 12 + 1),
+								 (uint8_t)((note - 1) % 12 + 1)};
+		if (isMainSynth) {
+			decodeMessage(TX_Message);
+		} else {
+			canSend(TX_Message);
+		}
+	} else if (type == MIDI_PITCH_BEND) {
+		joystick.setMidiBend(((message.data2 << 7 | message.data1) - 8192) * 8);
+	} else if (type == MIDI_CONTROL_CHANGE) {
+		switch (message.data1) {
+		case MIDI_CC_MODULATION:
+			joystick.setMidiModulation(message.data2 * 65536 / 127);
+			break;
+		case MIDI_CC_VOLUME:
+			K3.setRotation((message.data2 * (volumeFiner ? 20 : 5) + 63) / 127);
+			break;
+		case MIDI_CC_RESONANCE:
+			KQ.setRotation((message.data2 * (filterResonances - 1) + 63) / 127);
+			break;
+		case MIDI_CC_CUTOFF:
+			KC.setRotation((message.data2 * (filterCutoffs - 1) + 63) / 127);
+			break;
+		case MIDI_CC_ALL_SOUND_OFF:
+		case MIDI_CC_ALL_NOTES_OFF:
+			for (uint8_t note = 1; note < numNotes && isMainSynth; note++) {
+				if (activeNotes[note])
+					noteChanged(note, false);
 			}
-		} else if (RX_Message[0] == 0x4D) { // Main Synth Announce
-			isMainSynth = false;
-			K2.setRotation(1);
+			break;
 		}
 	}
 }
 
-// Function to send a CAN message containing a changed key and it's new state
-void keyChangedSendTXMessage(uint8_t octave, uint8_t key, bool pressed) {
-	uint8_t TX_Message[8] = {0};
-	if (pressed) {
-		TX_Message[0] = 0x50; // "P"
+// Periodic cluster work, run by decodeTask() so the scheduler is only used by one task
+// The main synth moves the notes of boards that stopped reporting, other boards report their load
+void clusterTick() {
+	if (!clusterMode || !isMainSynth) {
+		scheduler.reset();
 	} else {
-		TX_Message[0] = 0x52; // "R"
+		uint8_t heldNotes[numNotes];
+		uint8_t count = scheduler.expire(millis(), heldNotes);
+		for (uint8_t i = 0; i < count; i++) {
+			if (activeNotes[heldNotes[i]])
+				noteChanged(heldNotes[i], true);
+		}
+	}
+	if (clusterMode && !isMainSynth) {
+		uint8_t TX_Message[8] = {MSG_LOAD, nodeID, synth.getActiveVoices(), Synth::numVoices};
+		canSend(TX_Message);
+	}
+}
+
+// Decode every message waiting in msgInQ, rxRing and the MIDI receive buffer, and run clusterTick() every
+// loadReportInterval
+void decodePending() {
+	static TickType_t lastTick = xTaskGetTickCount();
+	uint8_t RX_Message[8];
+	CANFrame frame;
+	while (xQueueReceive(msgInQ, RX_Message, 0) == pdTRUE)
+		decodeMessage(RX_Message);
+#ifdef ENABLE_MIDI
+	uint8_t bytes[32];
+	uint32_t count;
+	while ((count = midiReceive(bytes, sizeof(bytes)))) {
+		MidiMessage message;
+		for (uint32_t i = 0; i < count; i++) {
+			if (midiParser.parse(bytes[i], message))
+				decodeMidiMessage(message);
+		}
+	}
+#endif
+	while (rxRing.pop(frame)) {
+		decodeMessage(frame.data);
+		uint32_t latency = micros() - frame.time;
+		if (latency > busStats.rxLatencyMax)
+			busStats.rxLatencyMax = latency;
+	}
+	if (xTaskGetTickCount() - lastTick >= loadReportInterval / portTICK_PERIOD_MS) {
+		lastTick = xTaskGetTickCount();
+		clusterTick();
+	}
+}
+
+// Task to decode pending messages each time it is notified, and at least every loadReportInterval
+void decodeTask(void *pvParameters) {
+	while (1) {
+		ulTaskNotifyTake(pdTRUE, loadReportInterval / portTICK_PERIOD_MS);
+		TRACE_ENTER(TRACE_DECODE);
+		decodePending();
+		TRACE_EXIT(TRACE_DECODE);
 	}
-	TX_Message[1] = octave;
-	TX_Message[2] = key;
+}
+
+#ifdef ENABLE_MIDI
+// Send every changed key of an octave as a MIDI note on or off, dropping them if the transmit ring is full
+void keysChangedSendMidi(uint8_t octave, uint16_t state, uint16_t changed) {
+	while (changed) {
+		uint8_t key = __builtin_ctz(changed);
+		changed &= changed - 1;
+		uint8_t message[3] = {(uint8_t)(MIDI_NOTE_ON | midiChannel), (uint8_t)((octave - 1) * 12 + key + 1 + midiNoteOffset),
+							  (uint8_t)((state & (0x1 << key)) ? midiVelocity : 0)};
+		midiSend(message, 3);
+	}
+}
+#endif
+
+// Function to send one message containing every changed key of an octave and their new states, and echo them as MIDI
+void keysChangedSendTXMessage(uint8_t octave, uint16_t state, uint16_t changed) {
+#ifdef ENABLE_MIDI
+	keysChangedSendMidi(octave, state, changed);
+#endif
+	uint8_t TX_Message[8];
+	keysEncoder.encode(TX_Message, octave, state, changed, nodeID);
 	if (isMainSynth) {
 		xQueueSend(msgInQ, TX_Message, 0);
+		xTaskNotifyGive(decodeHandle);
+	} else if (canSend(TX_Message)) {
+		busStats.keyEventsSent += __builtin_popcount(TX_Message[4] | (TX_Message[5] & 0x0F) << 8); // With any resent
 	} else {
-		CAN_TX(canID, TX_Message);
+		keysEncoder.dropped(TX_Message); // Sent again once msgOutQ has room, see scanKeysTask()
 	}
 }
 
-// Function to send CAN message instructing other synths to change to sending mode
+// Function to send CAN message instructing other synths to change to sending mode, or to give way if a board with a
+// lower node ID has just announced itself
 void announceMainSynth() {
-	uint8_t TX_Message[8] = {0};
-	TX_Message[0] = 0x4D; // "M"
-	CAN_TX(canID, TX_Message);
+	if (!electMainSynth(nodeID)) {
+		followMainSynth();
+		return;
+	}
+	uint8_t TX_Message[8] = {MSG_ANNOUNCE, clusterMode, nodeID};
+	canSend(TX_Message, true);
+}
+
+#ifndef ENABLE_MIDI // Serial gives up USART2 to MIDI
+// Function to print bus traffic since the last report over Serial, as
+// B,framesSent,framesReceived,bitsSent,bitsReceived,keyEventsSent,txDropped,txQueuePeak,rxDropped,rxQueuePeak,rxLatencyMax,ms
+void busStatsReport() {
+	static BusStats last = {};
+	static uint32_t lastTime = 0;
+	static uint32_t lastRxDropped = 0;
+	BusStats now = busStats;
+	uint32_t rxDropped = rxRing.getOverflows();
+	uint32_t time = millis();
+	Serial.print("B,");
+	Serial.print((unsigned long)(now.framesSent - last.framesSent));
+	Serial.print(",");
+	Serial.print((unsigned long)(now.framesReceived - last.framesReceived));
+	Serial.print(",");
+	Serial.print((unsigned long)(now.bitsSent - last.bitsSent));
+	Serial.print(",");
+	Serial.print((unsigned long)(now.bitsReceived - last.bitsReceived));
+	Serial.print(",");
+	Serial.print((unsigned long)(now.keyEventsSent - last.keyEventsSent));
+	Serial.print(",");
+	Serial.print((unsigned long)(now.txDropped - last.txDropped));
+	Serial.print(",");
+	Serial.print((unsigned long)now.txQueuePeak);
+	Serial.print(",");
+	Serial.print((unsigned long)(rxDropped - lastRxDropped));
+	Serial.print(",");
+	Serial.print((unsigned long)rxRing.getHighWater());
+	Serial.print(",");
+	Serial.print((unsigned long)now.rxLatencyMax);
+	Serial.print(",");
+	Serial.println((unsigned long)(time - lastTime));
+	last = now;
+	lastRxDropped = rxDropped;
+	lastTime = time;
+}
+
+// Function to print the time the sample timer spent parked since the last report over Serial, as
+// I,parks,parkedMs,ms
+void idleReport() {
+	static uint32_t lastCount = 0, lastParked = 0, lastTime = 0;
+	uint32_t time = millis();
+	uint32_t count = parkCount;
+	uint32_t parked = parkedTime;
+	if (audioParked) // Include the current park so far, read after parkedTime in case renderTask() resumes between
+		parked += time - parkedSince;
+	Serial.print("I,");
+	Serial.print((unsigned long)(count - lastCount));
+	Serial.print(",");
+	Serial.print((unsigned long)(parked - lastParked));
+	Serial.print(",");
+	Serial.println((unsigned long)(time - lastTime));
+	lastCount = count;
+	lastParked = parked;
+	lastTime = time;
+}
+
+// Function to print the fewest words each task has had free on its stack since it started over Serial, as
+// K,task,words
+void stackReport() {
+	const TaskHandle_t tasks[] = {renderHandle, scanKeysHandle, CAN_TX_Handle, decodeHandle, displayUpdateHandle};
+	for (TaskHandle_t task : tasks) {
+		Serial.print("K,");
+		Serial.print(pcTaskGetName(task));
+		Serial.print(",");
+		Serial.println((unsigned long)uxTaskGetStackHighWaterMark(task));
+	}
+}
+#endif
+
+// Node ID from the 96-bit unique device ID, folded to 8 bits and never 0
+uint8_t boardNodeID() {
+	uint32_t uid = HAL_GetUIDw0() ^ HAL_GetUIDw1() ^ HAL_GetUIDw2();
+	uint8_t id = uid ^ (uid >> 8) ^ (uid >> 16) ^ (uid >> 24);
+	return id ? id : 1;
+}
+
+// Gather the knob settings into one snapshot for renderTask(), including those set by decodeTask() from MIDI and
+// clock messages, and publish it whole
+void publishControls() {
+	Controls next;
+	next.gain = volumeGain(K3.getRotation(), volumeFiner);
+	next.waveform = K1.getRotation();
+	next.attack = attackCoefficients[KA.getRotation()];
+	next.decay = decayCoefficients[KD.getRotation()];
+	next.sustain = KS.getRotation() * 65536 / (envelopeSettings - 1);
+	next.release = decayCoefficients[KR.getRotation()];
+	next.filterType = KT.getRotation();
+	next.filterCutoff = KC.getRotation();
+	next.filterResonance = KQ.getRotation();
+	next.sequencerMode = KM.getRotation();
+	next.tempo = lowestTempo + tempoStep * KB.getRotation();
+	next.gate = KG.getRotation();
+	next.operators = KO.getRotation();
+	next.fmDepth = KI.getRotation() * fmDepthStep;
+	next.fmFeedback = KF.getRotation() * fmFeedbackStep;
+	controls.write(next);
+	if (next.sequencerMode != SEQ_OFF)
+		audioWake();
 }
 
 // Task to update keyArray values at a higher priority
 void scanKeysTask(void *pvParameters) {
-	const TickType_t xFrequency = 20 / portTICK_PERIOD_MS;
+	const TickType_t xFrequency = 1 / portTICK_PERIOD_MS;
 	TickType_t xLastWakeTime = xTaskGetTickCount();
+	uint8_t sentOctave = octave;
 	while (1) {
 		vTaskDelayUntil(&xLastWakeTime, xFrequency);
-		for (uint8_t i = 0; i < 7; i++) {
-			switch (i) {
-				case 3: // Display Power
-				case 4: // Display Reset, active low
-					setRow(i, HIGH);
-					break;
-				case 5: // Handshake Output West
-					setRow(i, handshakeWestOut);
-					break;
-				case 6: // Handshake Output East
-					setRow(i, handshakeEastOut);
-					break;
-				default: // Unimplemented
-					setRow(i, LOW);
-					break;
-			}
-			uint8_t oldRow = keyArray[i];
-			delayMicroseconds(3);
-			uint8_t newRow = readCols();
-			if (oldRow == newRow) {
-				continue;
+		TRACE_ENTER(TRACE_SCAN_KEYS);
+		uint32_t changed = keys.update(scanMatrix());
+		uint32_t state = keys.getState();
+		for (uint8_t i = 0; i < matrixRows; i++) {
+			keyArray[i] = (state >> (i * matrixColumns)) & 0xF;
+		}
+		uint16_t keyState = state & pianoKeysMask;
+		uint16_t changedKeys = changed & pianoKeysMask;
+		if (octave != sentOctave) { // Release every key sent in the old octave, press the held ones in the new one
+			uint16_t sentState = keyState ^ changedKeys;
+			if (sentState)
+				keysChangedSendTXMessage(sentOctave, 0, sentState);
+			changedKeys = keyState;
+			sentOctave = octave;
+		}
+		if (changedKeys) {
+			keysChangedSendTXMessage(octave, keyState, changedKeys);
+		}
+		for (uint8_t o = 0; o < keysOctaves; o++) { // Changes dropped by a full msgOutQ, every key is up outside sentOctave
+			if (keysEncoder.getUnsent(o) && uxQueueSpacesAvailable(msgOutQ))
+				keysChangedSendTXMessage(o, o == sentOctave ? keyState : 0, 0);
+		}
+		uint32_t pressed = changed & state;
+		if ((pressed & (0x1 << 20)) && isMainSynth) { // Knob 2 pressed
+			announceMainSynth();
+		}
+		if ((pressed & (0x1 << 21)) && rhythmMode) { // Knob 3 pressed in rhythm mode
+			sequencer.clearPattern();
+		} else if (pressed & (0x1 << 21)) { // Knob 3 pressed
+			volumeFiner = !volumeFiner;
+		}
+		if (pressed & (0x1 << 24)) { // Knob 0 pressed, cycles through normal, envelope, filter, rhythm and FM mode
+			if (envelopeMode) {
+				envelopeMode = false;
+				filterMode = true;
+			} else if (filterMode) {
+				filterMode = false;
+				rhythmMode = true;
+			} else if (rhythmMode) {
+				rhythmMode = false;
+				fmMode = true;
+			} else if (fmMode) {
+				fmMode = false;
 			} else {
-				keyArray[i] = newRow;
-				if (i < 3) {
-					for (uint8_t j = 0; j < 4; j++) {
-						if ((oldRow & (0x1 << j)) ^ (newRow & (0x1 << j))) {
-							keyChangedSendTXMessage(octave, i * 4 + j + 1, newRow & (0x1 << j));
-						}
-					}
-				}
+				envelopeMode = true;
 			}
 		}
-		if (keyArray[5] & 0x1 && isMainSynth) {
+		if ((pressed & (0x1 << 25)) && isMainSynth) { // Knob 1 pressed
+			clusterMode = !clusterMode;
 			announceMainSynth();
 		}
-		if (volumeFiner) {
-			K3.changeLimitsVolume(0, 20);
-		} else {
-			K3.changeLimitsVolume(0, 5);
+		K3.setLimits(0, volumeFiner ? 20 : 5, volumeStep(!volumeFiner), volumeStep(volumeFiner)); // Same loudness
+		knobs.update(state, millis());
+		Knob *turned[KnobBank::numKnobs] = {&K0, &K1, &K2, &K3};
+		if (envelopeMode) {
+			turned[0] = &KA;
+			turned[1] = &KD;
+			turned[2] = &KS;
+			turned[3] = &KR;
+		} else if (filterMode) {
+			turned[0] = &KT;
+			turned[1] = &KC;
+			turned[2] = &KQ;
+		} else if (rhythmMode) {
+			turned[0] = &KM;
+			turned[1] = &KB;
+			turned[2] = &KG;
+		} else if (fmMode) {
+			turned[0] = &KO;
+			turned[1] = &KI;
+			turned[2] = &KF;
 		}
-		K0.updateRotation(keyArray[4] & 0x4, keyArray[4] & 0x8);
-		K1.updateRotation(keyArray[4] & 0x1, keyArray[4] & 0x2);
-		K2.updateRotation(keyArray[3] & 0x4, keyArray[3] & 0x8);
-		K3.updateRotation(keyArray[3] & 0x1, keyArray[3] & 0x2);
+		for (uint8_t k = 0; k < KnobBank::numKnobs; k++)
+			turned[k]->turn(knobs.takeSteps(k), knobs.getAcceleration(k));
+		publishControls();
 		octave = K0.getRotation();
 		selectedWaveform = K1.getRotation();
 		isMainSynth = !K2.getRotation();
 		volume = K3.getRotation();
-		volumeHistory = (volumeHistory << 1) + ((keyArray[5] & 0x2) >> 1);
-		volumeFiner = ((!(volumeHistory == 1)) & volumeFiner) | ((volumeHistory == 1) & !volumeFiner);
+		TRACE_EXIT(TRACE_SCAN_KEYS);
 	}
 }
 
-// Task containing display graphics and update code
+// Task to redraw and send the parts of the display that changed since the last frame
 void displayUpdateTask(void *pvParameters) {
-	const TickType_t xFrequency = 100 / portTICK_PERIOD_MS;
+	const TickType_t xFrequency = displayInterval / portTICK_PERIOD_MS;
 	TickType_t xLastWakeTime = xTaskGetTickCount();
+	uint8_t frame = 0;
 	while (1) {
 		vTaskDelayUntil(&xLastWakeTime, xFrequency);
-		u8g2.clearBuffer();					   // clear the internal memory
-		u8g2.setFont(u8g2_font_profont12_mf);  // choose a suitable font
-		u8g2.drawStr(2, 10, notes[latestKey]); // Print the currently pressed keys
-
-		u8g2.setCursor(2, 20);
-		for (uint8_t i = 0; i < 7; i++) {
-			u8g2.print(keyArray[i], HEX);
-		};
-		// u8g2.setCursor(100, 10); // Debug print of received CAN message
-		// u8g2.print((char)RX_Message[0]);
-		// u8g2.print(RX_Message[1]);
-		// u8g2.print(RX_Message[2], HEX);
-
-		// Print current octave number above knob 0
-		u8g2.drawStr(2, 30, "O:");
-		u8g2.setCursor(14, 30);
-		u8g2.print(octave);
-
-		// Draw currently selected waveform above knob 1
-		u8g2.drawXBM(38, 22, 13, 9, waveforms[K1.getRotation()]);
-
-		// Print Send / Receive State above knob 2
-		if (K2.getRotation()) {
-			u8g2.drawStr(74, 30, "SEND");
-		} else {
-			u8g2.drawStr(74, 30, "RECV");
+		TRACE_ENTER(TRACE_DISPLAY);
+		if (++frame == 1000 / displayInterval) { // Once a second
+			frame = 0;
+#ifndef ENABLE_MIDI
+			busStatsReport();
+			idleReport();
+			stackReport();
+#endif
 		}
-
-		// Print volume indicator above knob 3
-		if (!volumeFiner) {
-			u8g2.drawXBM(112, 22, 13, 9, volumes[volume]);
-		} else {
-			u8g2.setCursor(117, 30);
-			u8g2.print(volume);
-		}
-
-		if (!isMainSynth) {
-			u8g2.drawHLine(1, 6, 26);
-			u8g2.drawHLine(36, 26, 18);
-			u8g2.drawHLine(110, 26, 16);
-			u8g2.drawStr(40, 10, "Secondary Mode");
+		DisplayState state;
+		state.note = notes[latestKey].name;
+		for (uint8_t i = 0; i < 7; i++) {
+			state.keys[i] = keyArray[i];
 		}
-
-		u8g2.sendBuffer();			// transfer internal memory to the display
+		state.octave = octave;
+		state.waveform = K1.getRotation();
+		state.send = K2.getRotation();
+		state.volume = volume;
+		state.volumeFiner = volumeFiner;
+		state.secondary = !isMainSynth;
+		state.clusterNodes = clusterMode ? scheduler.getNodeCount() : 0;
+		state.envelopeMode = envelopeMode;
+		state.envelope[0] = KA.getRotation();
+		state.envelope[1] = KD.getRotation();
+		state.envelope[2] = KS.getRotation();
+		state.envelope[3] = KR.getRotation();
+		state.filterMode = filterMode;
+		state.filter[0] = KT.getRotation();
+		state.filter[1] = KC.getRotation();
+		state.filter[2] = KQ.getRotation();
+		state.rhythmMode = rhythmMode;
+		state.rhythm[0] = KM.getRotation();
+		state.rhythm[1] = lowestTempo + tempoStep * KB.getRotation();
+		state.rhythm[2] = KG.getRotation();
+		state.fmMode = fmMode;
+		state.fm[0] = KO.getRotation();
+		state.fm[1] = KI.getRotation();
+		state.fm[2] = KF.getRotation();
+		ui.update(u8g2, state);
 		digitalToggle(LED_BUILTIN); // Toggle LED to show display update rate
+		TRACE_EXIT(TRACE_DISPLAY);
 	}
 }
 
@@ -355,22 +981,42 @@ void setup() {
 	pinMode(RA2_PIN, OUTPUT);
 	pinMode(REN_PIN, OUTPUT);
 	pinMode(OUT_PIN, OUTPUT);
-	pinMode(OUTL_PIN, OUTPUT);
-	pinMode(OUTR_PIN, OUTPUT);
 	pinMode(LED_BUILTIN, OUTPUT);
 	pinMode(C0_PIN, INPUT);
 	pinMode(C1_PIN, INPUT);
 	pinMode(C2_PIN, INPUT);
 	pinMode(C3_PIN, INPUT);
-	pinMode(JOYX_PIN, INPUT);
-	pinMode(JOYY_PIN, INPUT);
+	RA_REG[0] = pinRegister(RA0_PIN);
+	RA_REG[1] = pinRegister(RA1_PIN);
+	RA_REG[2] = pinRegister(RA2_PIN);
+	REN_REG = pinRegister(REN_PIN);
+	OUT_REG = pinRegister(OUT_PIN);
+	C_REG[0] = pinRegister(C0_PIN);
+	C_REG[1] = pinRegister(C1_PIN);
+	C_REG[2] = pinRegister(C2_PIN);
+	C_REG[3] = pinRegister(C3_PIN);
 #pragma endregion
 #pragma region Variables Setup
 	isMainSynth = true;
+	clusterMode = false;
+	nodeID = boardNodeID();
+	scheduler.setLocalID(nodeID);
+	envelopeMode = false;
+	filterMode = false;
+	rhythmMode = false;
+	fmMode = false;
+	publishControls();
 	octave = 4;
 	handshakeWestOut = false;
 	handshakeEastOut = true;
 #pragma endregion
+#pragma region Joystick Setup
+	joystickInit(); // Takes JOYX_PIN and JOYY_PIN as analog inputs
+	delay(20);		// Fill the DMA buffer before taking the rest position as the centre
+	uint32_t joyX, joyY;
+	joystickRead(joyX, joyY);
+	joystick.calibrate(joyX, joyY);
+#pragma endregion
 #pragma region Display Setup
 	setOutMuxBit(DRST_BIT, LOW); // Assert display logic reset
 	delayMicroseconds(2);
@@ -379,33 +1025,58 @@ void setup() {
 	setOutMuxBit(DEN_BIT, HIGH); // Enable display power supply
 #pragma endregion
 #pragma region UART Setup
+#ifndef ENABLE_MIDI
 	Serial.begin(115200);
 	Serial.println("Hello World");
+#endif
 #pragma endregion
+#ifdef ENABLE_TRACE
+	traceInit();
+#endif
 #pragma region CAN Setup
-	msgInQ = xQueueCreate(36, 8);
+	msgInQ = xQueueCreate(8, 8);
+	msgOutQ = xQueueCreate(36, 8);
+	CAN_TX_Semaphore = xSemaphoreCreateCounting(3, 3); // One count per hardware mailbox
 	CAN_Init(true);
-	setCANFilter(canID, 0x7fc); // Mask last 2 bits
+	setCANFilter(canBaseID, canFilterMask);
 	CAN_RegisterRX_ISR(CAN_RX_ISR);
+	CAN_RegisterTX_ISR(CAN_TX_ISR);
 	CAN_Start();
 #pragma endregion
+#ifdef ENABLE_MIDI
+#pragma region MIDI Setup
+	MIDI_Init(midiBaudRate); // Takes USART2, the virtual COM port, instead of Serial
+	MIDI_RegisterRX_ISR(MIDI_RX_ISR);
+#pragma endregion
+#endif
 #pragma region Task Scheduler Setup
-	TIM_TypeDef *Instance = TIM1;
-	HardwareTimer *sampleTimer = new HardwareTimer(Instance);
-	sampleTimer->setOverflow(samplingRate, HERTZ_FORMAT);
-	sampleTimer->attachInterrupt(sampleISR);
-	sampleTimer->resume();
-	TaskHandle_t scanKeysHandle = nullptr;
-	TaskHandle_t displayUpdateHandle = nullptr;
-	TaskHandle_t decodeHandle = nullptr;
+	xTaskCreate(
+		renderTask,	  // Function that implements the task
+		"render",	  // Text name for the task
+		128,		  // Stack size in words, not bytes
+		nullptr,	  // Parameter passed into the task
+		4,			  // Task priority
+		&renderHandle // Pointer to store the task handle
+	);
+	// scanKeysTask() goes deepest through keysChangedSendTXMessage(), keysChangedSendMidi() and xQueueSend(), about
+	// 85 words, and a context switch stacks up to 50 more with the FPU registers. Twice that leaves room for the
+	// compiler inlining differently, check the K,scanKeys line printed over Serial
 	xTaskCreate(
 		scanKeysTask,	// Function that implements the task
 		"scanKeys",		// Text name for the task
-		64,				// Stack size in words, not bytes
+		256,			// Stack size in words, not bytes
 		nullptr,		// Parameter passed into the task
 		3,				// Task priority
 		&scanKeysHandle // Pointer to store the task handle
 	);
+	xTaskCreate(
+		CAN_TX_Task,	// Function that implements the task
+		"CAN_TX",		// Text name for the task
+		128,			// Stack size in words, not bytes
+		nullptr,		// Parameter passed into the task
+		2,				// Task priority
+		&CAN_TX_Handle	// Pointer to store the task handle
+	);
 	xTaskCreate(
 		decodeTask,	  // Function that implements the task
 		"decode",	  // Text name for the task
@@ -414,6 +1085,16 @@ void setup() {
 		2,			  // Task priority
 		&decodeHandle // Pointer to store the task handle
 	);
+#ifdef ENABLE_TRACE
+	xTaskCreate(
+		traceTask,	// Function that implements the task
+		"trace",	// Text name for the task
+		256,		// Stack size in words, not bytes
+		nullptr,	// Parameter passed into the task
+		2,			// Task priority, above displayUpdateTask so the ring is drained during its long frames
+		nullptr		// Pointer to store the task handle
+	);
+#endif
 	xTaskCreate(
 		displayUpdateTask,	 // Function that implements the task
 		"displayUpdate",	 // Text name for the task
@@ -422,8 +1103,31 @@ void setup() {
 		1,					 // Task priority
 		&displayUpdateHandle // Pointer to store the task handle
 	);
+#ifdef ENABLE_BENCH
+	xTaskCreate(
+		benchTask, // Function that implements the task
+		"bench",   // Text name for the task
+		512,	   // Stack size in words, not bytes
+		nullptr,   // Parameter passed into the task
+		5,		   // Task priority, above every other task so none runs during the benchmarks
+		nullptr	   // Pointer to store the task handle
+	);
+#endif
+	for (uint32_t i = 0; i < 2 * blockSize; i++) { // Start both halves at the DAC midpoint
+		dacBuffer[i] = 128 | 128 << 8;
+	}
+	bufferAactive = true;
+	bufferReady = true;
+	synth.setStereo(stereoOutput);
+	DAC_Init(samplingRate, dacBuffer, 2 * blockSize, DAC_DMA_ISR);
+	DAC_Start();
 	vTaskStartScheduler();
 #pragma endregion
 }
 
-void loop() {} // No code in loop, as everything is done in the tasks
+// Run by the FreeRTOS idle task, sleeping the core until the next interrupt, as everything is done in the tasks
+void loop() {
+#ifndef NATIVE_BUILD
+	__WFI();
+#endif
+}
@@ -0,0 +1,20 @@
+// Microbenchmark runner for the native build
+// Runs the benchmarks in src/bench.cpp against the firmware after setup(), and exits with 1 if any is over its budget
+// or its ceiling
+//
+// Usage: program [speedup]
+//
+// The budgets are scaled to this host by a calibration loop, see src/bench.cpp. speedup is how many times faster than
+// the 80MHz board the host is taken to be for the ceilings, so a benchmark also fails if its median time is over its
+// ceiling in cycles at 80MHz divided by speedup. The default of 4 is a guess, not a measurement: any desktop host is
+// well over 4 times faster, so the ceilings stay the looser gate
+#include <cstdlib>
+#include <firmware.h>
+
+int main(int argc, char **argv) {
+	uint32_t speedup = argc > 1 ? atoi(argv[1]) : 4;
+	if (!speedup)
+		speedup = 1;
+	setup();
+	return runBenchmarks(speedup) ? 1 : 0;
+}
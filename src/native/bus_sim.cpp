@@ -0,0 +1,405 @@
+// Virtual CAN bus benchmark for the native build
+// Runs the firmware as the main synth on node 0 of the bus model in es_can_native.cpp, alongside simulated boards
+// that scan their keys every 1ms and send one MSG_KEYS message per scan through a 36 message queue and the three
+// transmit mailboxes, as scanKeysTask() and CAN_TX_Task() do. The bus runs at 125kbit/s with bit stuffing, and each
+// board sends with its own CAN ID from its node ID, as the firmware does.
+// Each key change is timed from the scan that found it to decodeTask() on the main synth decoding it, including
+// changes whose message was dropped and that were only sent again once the board's queue had room, as scanKeysTask()
+// does
+// Each board numbers its messages with its own KeysEncoder, as the firmware does, and changes octave as
+// scanKeysTask() does in the octaves scenario, so a numbering that does not match KeysDecoder shows up as resyncs
+// Each scenario passes or fails on limits set from its measured results with a margin, see KeysLimits, and the
+// program exits with 1 if any fails
+//
+// Usage: program <scenario> [seconds]
+//
+// Scenarios
+//   chord      7 boards press and release a 4 note chord on the same scan every 24ms
+//   mash<n>    mash2, mash4, mash6 or mash8, n boards in total each changing 1-3 random keys on 30% of scans
+//   octaves    4 boards as in mash4, each also moving up or down an octave every 100ms while holding keys
+//   announce   4 boards announce themselves as the main synth at the same time, 50 times, each time leaving exactly
+//              one main synth, the board with the lowest node ID
+//   all        Every scenario above in turn, the default
+#include <Arduino.h>
+#include <STM32FreeRTOS.h>
+#include <algorithm>
+#include <atomic>
+#include <can_proto>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <es_can>
+#include <firmware.h>
+#include <random>
+#include <vector>
+
+static const uint64_t stepNanos = 10000;		// Simulation step, 10us
+static const uint64_t scanNanos = 1000000;		// scanKeysTask() period
+static const uint64_t drainNanos = 1000000000;	// Time given to the bus to empty at the end of a scenario
+static const uint32_t txQueueLength = 36;		// As msgOutQ
+static const uint32_t simBoards = native::canMaxNodes - 1;
+static const uint8_t firmwareNode = 0x15; // Between the simulated boards' 0x12, 0x14 and up, so it wins some races
+
+// Limits a key scenario must stay within to pass, each about 1.5 times what it was measured at over 2 seconds
+// Scenarios within the bus capacity must drop nothing. mash6 and mash8 ask for more frames than 125kbit/s carries, so
+// their limits bound how far they degrade: the boards with the highest node IDs are starved until the keys stop, so
+// their p90 and p99 grow with the length of the run and only the p50 is limited. Dropped changes are sent again, so
+// every scenario must lose none, keep up on the main synth, dropping nothing from its receive FIFO or rxRing, and
+// end with no note left on
+struct KeysLimits {
+	double dropped;			// Share of the boards' messages dropped from their transmit queues
+	double lost;			// Share of the key changes never decoded
+	uint32_t p50, p90, p99; // Latency in us, 0 for no limit
+};
+
+// Key changes found by one scan of a simulated board, waiting to be decoded by the main synth
+struct Pending {
+	uint8_t octave;
+	uint8_t sequence;
+	uint64_t time;
+	uint8_t changes;
+};
+
+struct SimBoard {
+	uint8_t nodeID;
+	uint8_t octave;
+	bool isMain;
+	MainElection election;
+	KeysEncoder encoder; // Kept across scenarios, as the main synth's KeysDecoder is
+	uint16_t keys;
+	uint64_t keyChanged[12]; // Time each key last changed, to keep random presses at a playable rate
+	uint64_t nextScan;
+	uint8_t txQueue[txQueueLength][8];
+	uint32_t txHead, txLength;
+	std::deque<Pending> pending;
+};
+
+static SimBoard boards[simBoards + 1]; // Index 0 is unused, it is the firmware
+static uint32_t boardCount;
+static uint32_t txQueued;
+static uint32_t txDropped;
+static std::vector<uint64_t> latencies;
+static std::mt19937 rng(1);
+
+// Receive ISR of a simulated board, which only acts on announcements, giving way to those that win the election as
+// mainSynthAnnounced() does
+template <uint32_t Node>
+static void simRX_ISR() {
+	uint32_t ID;
+	uint8_t RX_Message[8];
+	while (CAN_CheckRXLevel()) {
+		CAN_RX(ID, RX_Message);
+		if (RX_Message[0] == MSG_ANNOUNCE && boards[Node].election.announce(RX_Message[2], millis()))
+			boards[Node].isMain = false;
+	}
+}
+
+static void (*const simRX_ISRs[simBoards + 1])() = {nullptr,		  simRX_ISR<1>, simRX_ISR<2>, simRX_ISR<3>,
+												   simRX_ISR<4>, simRX_ISR<5>, simRX_ISR<6>, simRX_ISR<7>};
+
+static bool queueMessage(SimBoard &board, const uint8_t TX_Message[8], bool urgent) {
+	txQueued++;
+	if (board.txLength == txQueueLength) {
+		txDropped++;
+		return false;
+	}
+	if (urgent) {
+		board.txHead = (board.txHead + txQueueLength - 1) % txQueueLength;
+		memcpy(board.txQueue[board.txHead], TX_Message, 8);
+	} else {
+		memcpy(board.txQueue[(board.txHead + board.txLength) % txQueueLength], TX_Message, 8);
+	}
+	board.txLength++;
+	return true;
+}
+
+// Equivalent of keysChangedSendTXMessage() on a secondary board
+// The changes of a dropped message stay pending under its sequence number, which the resend reuses, so they are timed
+// from the scan that first found them
+static void sendMessage(SimBoard &board, uint8_t octave, uint16_t state, uint16_t changed) {
+	uint8_t TX_Message[8];
+	board.encoder.encode(TX_Message, octave, state, changed, board.nodeID);
+	if (changed)
+		board.pending.push_back({octave, TX_Message[6], native::nanos(), (uint8_t)__builtin_popcount(changed)});
+	if (!queueMessage(board, TX_Message, false))
+		board.encoder.dropped(TX_Message);
+}
+
+// Sends again the changes of dropped messages while the queue has room, as scanKeysTask() does
+static void resendDropped(SimBoard &board) {
+	for (uint8_t o = 0; o < keysOctaves; o++) {
+		if (board.encoder.getUnsent(o) && board.txLength < txQueueLength)
+			sendMessage(board, o, o == board.octave ? board.keys : 0, 0);
+	}
+}
+
+static void sendKeys(SimBoard &board, uint16_t keys) {
+	uint16_t changed = keys ^ board.keys;
+	if (!changed)
+		return;
+	uint64_t now = native::nanos();
+	for (uint8_t k = 0; k < 12; k++) {
+		if (changed & (0x1 << k))
+			board.keyChanged[k] = now;
+	}
+	board.keys = keys;
+	sendMessage(board, board.octave, keys, changed);
+}
+
+// Moves a board to another octave as scanKeysTask() does, releasing its held keys in the old octave and pressing
+// them in the new one
+static void changeOctave(SimBoard &board, uint8_t octave) {
+	if (board.keys)
+		sendMessage(board, board.octave, 0, board.keys);
+	board.octave = octave;
+	if (board.keys)
+		sendMessage(board, board.octave, board.keys, board.keys);
+}
+
+// Starts the simulated boards, each scanning at a different point of the 1ms period unless aligned
+static void startBoards(uint32_t count, bool aligned) {
+	boardCount = count;
+	native::canSetNodes(count);
+	uint64_t now = native::nanos();
+	for (uint32_t i = 1; i < count; i++) {
+		SimBoard &board = boards[i];
+		board.nodeID = 0x10 + 2 * i;
+		board.octave = i;
+		board.isMain = false;
+		board.election = MainElection();
+		board.keys = 0;
+		for (uint64_t &time : board.keyChanged)
+			time = now;
+		board.nextScan = now + (aligned ? 0 : rng() % (scanNanos / stepNanos) * stepNanos);
+		board.txHead = 0;
+		board.txLength = 0;
+		board.pending.clear();
+		native::canSelectNode(i);
+		CAN_Init(false);
+		setCANFilter(canBaseID, canFilterMask);
+		CAN_RegisterRX_ISR(*simRX_ISRs[i]);
+		CAN_Start();
+	}
+	native::canSelectNode(0);
+}
+
+// Records the latency of every key change the main synth has decoded
+static void collectDecoded() {
+	uint64_t now = native::nanos();
+	for (uint32_t i = 1; i < boardCount; i++) {
+		SimBoard &board = boards[i];
+		while (!board.pending.empty()) {
+			uint8_t next = keysDecoder.getNextSequence(board.nodeID, board.pending.front().octave);
+			uint8_t behind = next - board.pending.front().sequence; // 1 for the last message decoded
+			if (behind == 0 || behind > 128)
+				break;
+			for (uint8_t c = 0; c < board.pending.front().changes; c++)
+				latencies.push_back(now - board.pending.front().time);
+			board.pending.pop_front();
+		}
+	}
+}
+
+// Advances every board, the bus and the main synth by one step
+static void step() {
+	native::advanceNanos(stepNanos);
+	for (uint32_t i = 1; i < boardCount; i++) {
+		SimBoard &board = boards[i];
+		native::canSelectNode(i);
+		while (board.txLength && CAN_TX(canBaseID | board.nodeID, board.txQueue[board.txHead]) == 0) {
+			board.txHead = (board.txHead + 1) % txQueueLength;
+			board.txLength--;
+		}
+	}
+	native::canSelectNode(0);
+	while (transmitNextMessage(0))
+		;
+	native::canRunBus();
+	decodePending(); // decodeTask() is notified by CAN_RX_ISR() and runs at once
+	collectDecoded();
+}
+
+static uint64_t percentile(const std::vector<uint64_t> &sorted, double p) {
+	return sorted[std::min(sorted.size() - 1, (size_t)(p * sorted.size()))];
+}
+
+// Runs keys() on every board at each scan for the given time, then releases every key and lets the bus drain
+// With octavePeriod set, each board moves an octave up and back down again every octavePeriod scans
+// Bus load is over the whole run including the drain, key changes still waiting at the end are counted as lost
+// Returns false if the results are outside limits
+static bool runKeys(const char *name, uint32_t count, bool aligned, double seconds,
+					uint16_t (*keys)(SimBoard &board, uint64_t scan), const KeysLimits &limits,
+					uint32_t octavePeriod = 0) {
+	startBoards(count, aligned);
+	for (uint8_t note = 0; note < numNotes; note++) // Notes left on by an earlier scenario are not this one's
+		activeNotes[note] = false;
+	latencies.clear();
+	txQueued = 0;
+	txDropped = 0;
+	native::CanBusStats bus = native::canBusStats();
+	uint32_t ringDropped = rxRing.getOverflows();
+	uint32_t resyncs = keysDecoder.resyncCount;
+	uint64_t start = native::nanos();
+	uint64_t end = start + (uint64_t)(seconds * 1e9);
+	uint32_t events = 0;
+	while (native::nanos() < end + drainNanos) {
+		for (uint32_t i = 1; i < count; i++) {
+			SimBoard &board = boards[i];
+			if (native::nanos() < board.nextScan)
+				continue;
+			uint64_t scan = (board.nextScan - start) / scanNanos;
+			if (octavePeriod && scan && scan % octavePeriod == 0)
+				changeOctave(board, (scan / octavePeriod) % 2 ? i + 1 : i);
+			uint16_t before = board.keys;
+			sendKeys(board, native::nanos() < end ? keys(board, scan) & 0xFFF : 0);
+			events += __builtin_popcount(before ^ board.keys);
+			resendDropped(board);
+			board.nextScan += scanNanos;
+		}
+		step();
+	}
+	uint32_t lost = 0;
+	for (uint32_t i = 1; i < count; i++) {
+		for (const Pending &pending : boards[i].pending)
+			lost += pending.changes;
+	}
+	native::CanBusStats busNow = native::canBusStats();
+	uint64_t elapsed = native::nanos() - start;
+	std::sort(latencies.begin(), latencies.end());
+	printf("%-9s boards %u  key changes %6u  frames %6u  bus load %5.1f%%\n", name, (unsigned)count, (unsigned)events,
+		   (unsigned)(busNow.framesSent - bus.framesSent), 100.0 * (busNow.busyNanos - bus.busyNanos) / elapsed);
+	if (!latencies.empty()) {
+		printf("          latency us  p50 %7.1f  p90 %7.1f  p99 %7.1f  max %7.1f\n", percentile(latencies, 0.5) / 1e3,
+			   percentile(latencies, 0.9) / 1e3, percentile(latencies, 0.99) / 1e3, latencies.back() / 1e3);
+	}
+	printf("          dropped  tx queue %u  rx FIFO %u  rx ring %u  resyncs %u  lost %u\n",
+		   (unsigned)txDropped, (unsigned)(busNow.rxOverruns - bus.rxOverruns),
+		   (unsigned)(rxRing.getOverflows() - ringDropped), (unsigned)(keysDecoder.resyncCount - resyncs),
+		   (unsigned)lost);
+	printf("          arbitration  contended %u  same ID %u\n", (unsigned)(busNow.arbitrations - bus.arbitrations),
+		   (unsigned)(busNow.sameIDContentions - bus.sameIDContentions));
+	uint32_t stuck = 0;
+	for (uint8_t note = 0; note < numNotes; note++)
+		stuck += activeNotes[note];
+	double dropped = txQueued ? (double)txDropped / txQueued : 0;
+	double lostShare = events ? (double)lost / events : 0;
+	uint64_t p50 = latencies.empty() ? 0 : percentile(latencies, 0.5) / 1000;
+	uint64_t p90 = latencies.empty() ? 0 : percentile(latencies, 0.9) / 1000;
+	uint64_t p99 = latencies.empty() ? 0 : percentile(latencies, 0.99) / 1000;
+	bool pass = dropped <= limits.dropped && lostShare <= limits.lost && (!limits.p50 || p50 <= limits.p50) &&
+				(!limits.p90 || p90 <= limits.p90) && (!limits.p99 || p99 <= limits.p99) && !stuck &&
+				busNow.rxOverruns == bus.rxOverruns && rxRing.getOverflows() == ringDropped;
+	printf("          limits  dropped %.1f%% of %.0f%%  lost %.1f%% of %.0f%%  stuck notes %u  %s\n", 100 * dropped,
+		   100 * limits.dropped, 100 * lostShare, 100 * limits.lost, (unsigned)stuck, pass ? "PASS" : "FAIL");
+	return pass;
+}
+
+// A chord rooted on a different key for each board and period, held for half of the period
+static uint16_t chordKeys(SimBoard &board, uint64_t scan) {
+	const uint64_t period = 24;
+	if (scan % period >= period / 2)
+		return 0;
+	uint8_t root = (scan / period + board.octave) % 12;
+	return (0x1 << root) | (0x1 << (root + 4) % 12) | (0x1 << (root + 7) % 12) | (0x1 << (root + 11) % 12);
+}
+
+// Toggles 1-3 random keys that have not changed in the last 4ms
+static uint16_t mashKeys(SimBoard &board, uint64_t scan) {
+	uint16_t keys = board.keys;
+	if (rng() % 100 >= 30)
+		return keys;
+	uint32_t toggles = 1 + rng() % 3;
+	for (uint32_t t = 0; t < toggles; t++) {
+		uint8_t key = rng() % 12;
+		if (native::nanos() - board.keyChanged[key] >= 4 * scanNanos)
+			keys ^= 0x1 << key;
+	}
+	return keys;
+}
+
+// Every board, including the firmware, announces itself as the main synth in the same scan, in rounds further apart
+// than MainElection::raceWindow. Returns false unless every round leaves exactly one main synth, the board with the
+// lowest node ID, which is simulated board 1
+static bool runAnnounce(uint32_t rounds) {
+	const uint32_t count = 4;
+	startBoards(count, true);
+	native::CanBusStats bus = native::canBusStats();
+	uint32_t outcomes[count + 1] = {0};
+	uint32_t lowestWon = 0;
+	for (uint32_t r = 0; r < rounds; r++) {
+		isMainSynth = true;
+		K2.setRotation(0);
+		for (uint32_t i = 1; i < count; i++) {
+			boards[i].isMain = boards[i].election.announce(boards[i].nodeID, millis());
+			uint8_t TX_Message[8] = {MSG_ANNOUNCE, 0, boards[i].nodeID};
+			if (boards[i].isMain)
+				queueMessage(boards[i], TX_Message, true);
+		}
+		announceMainSynth();
+		for (uint64_t t = 0; t < 2 * MainElection::raceWindow * 1000000; t += stepNanos)
+			step();
+		uint32_t mains = isMainSynth;
+		for (uint32_t i = 1; i < count; i++)
+			mains += boards[i].isMain;
+		outcomes[mains]++;
+		lowestWon += mains == 1 && boards[1].isMain;
+	}
+	isMainSynth = true;
+	K2.setRotation(0);
+	native::CanBusStats busNow = native::canBusStats();
+	printf("%-9s boards %u  rounds %u  frames %u  same ID contentions %u\n", "announce", (unsigned)count,
+		   (unsigned)rounds, (unsigned)(busNow.framesSent - bus.framesSent),
+		   (unsigned)(busNow.sameIDContentions - bus.sameIDContentions));
+	printf("          main synths after the race");
+	for (uint32_t m = 0; m <= count; m++)
+		printf("  %u: %u", (unsigned)m, (unsigned)outcomes[m]);
+	bool pass = lowestWon == rounds;
+	printf("  lowest node won %u  %s\n", (unsigned)lowestWon, pass ? "PASS" : "FAIL");
+	return pass;
+}
+
+int main(int argc, char **argv) {
+	const char *scenario = argc > 1 ? argv[1] : "all";
+	double seconds = argc > 2 ? atof(argv[2]) : 2.0;
+	bool all = !strcmp(scenario, "all");
+	bool known = all;
+	bool pass = true;
+
+	native::uid = firmwareNode;
+	setup();
+	CAN_Init(false); // The firmware starts in loopback mode
+	if (all || !strcmp(scenario, "chord")) {
+		pass &= runKeys("chord", 8, true, seconds, chordKeys, {0, 0, 0, 0, 10000});
+		known = true;
+	}
+	const KeysLimits mashLimits[] = {
+		{0, 0, 0, 0, 2000},				// mash2
+		{0, 0, 0, 0, 20000},			// mash4
+		{0.32, 0, 5000, 0, 0},		// mash6
+		{0.60, 0, 170000, 0, 0},	// mash8
+	};
+	for (uint32_t n = 2; n <= 8; n += 2) {
+		char name[8];
+		snprintf(name, sizeof(name), "mash%u", (unsigned)n);
+		if (all || !strcmp(scenario, name)) {
+			pass &= runKeys(name, n, false, seconds, mashKeys, mashLimits[n / 2 - 1]);
+			known = true;
+		}
+	}
+	if (all || !strcmp(scenario, "octaves")) {
+		pass &= runKeys("octaves", 4, false, seconds, mashKeys, {0, 0, 0, 0, 35000}, 100);
+		known = true;
+	}
+	if (all || !strcmp(scenario, "announce")) {
+		pass &= runAnnounce(50);
+		known = true;
+	}
+	if (!known) {
+		fprintf(stderr, "Unknown scenario '%s'\n", scenario);
+		return 1;
+	}
+	native::CanBusStats bus = native::canBusStats();
+	printf("Bus total  frames %u  ack errors %u\n", (unsigned)bus.framesSent, (unsigned)bus.ackErrors);
+	return pass ? 0 : 1;
+}
@@ -0,0 +1,229 @@
+// Offline renderer for the native build
+// Replays a scripted key event file through decodeMessage(), the DAC DMA model and renderPending(),
+// writing both DAC channels to an 8-bit stereo WAV file and printing timing statistics
+//
+// Usage: program <events.txt> <output.wav>
+//
+// Each line of the event file is "<time in ms> <command> [arguments]", # starts a comment
+//   press <octave> <key>   Key pressed, key is 1-12 starting at C
+//   release <octave> <key> Key released
+//   wave <0-5>             Select waveform: square, sawtooth, triangle, sine, sample, FM
+//   volume <0-5>           Set volume
+//   envelope <a> <d> <s> <r> Set the attack, decay, sustain and release knobs, each 0-15
+//   joystick <x> <y>       Move the joystick, each 0-65535 with the centre at 32768
+//   stereo <0-1>           Select mono or stereo output
+//   filter <t> <c> <q>     Set the filter type (off, low, high, band pass), cutoff 0-43 and resonance 0-15 knobs
+//   seq <m> <b> <g>        Set the sequencer mode (off, up, down, random, pattern), tempo 0-51 and gate 1-4 knobs
+//   fm <o> <i> <f>         Set the FM operators 2-4, depth 0-15 and feedback 0-7 knobs
+//   midi <byte> ...        Receive up to 4 bytes over MIDI as one burst, such as 0x90 69 100 for A4 on
+//   end                    Stop rendering at this time
+#include <Arduino.h>
+#include <STM32FreeRTOS.h>
+#include <atomic>
+#include <can_proto>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <dac>
+#include <firmware.h>
+#include <joystick>
+#include <midi>
+#include <vector>
+
+typedef std::chrono::steady_clock Clock;
+
+struct Event {
+	uint32_t timeMs;
+	char command[16];
+	int arg0, arg1, arg2, arg3;
+	int argCount;
+};
+
+struct Timing {
+	uint64_t count = 0, totalNs = 0, minNs = UINT64_MAX, maxNs = 0;
+
+	void add(uint64_t ns) {
+		count++;
+		totalNs += ns;
+		if (ns < minNs)
+			minNs = ns;
+		if (ns > maxNs)
+			maxNs = ns;
+	}
+
+	void print(const char *name) {
+		if (!count) {
+			printf("%-16s not called\n", name);
+			return;
+		}
+		printf("%-16s calls %8llu  min %9.3fus  avg %9.3fus  max %9.3fus\n", name, (unsigned long long)count,
+			   minNs / 1e3, totalNs / 1e3 / count, maxNs / 1e3);
+	}
+};
+
+static std::vector<uint8_t> samples;
+
+// Samples are interleaved left then right, as the DAC model writes OUTR_PIN (A3) then OUTL_PIN (A4)
+static void captureSample(uint32_t pin, uint32_t value) {
+	if (pin == A3) {
+		samples.push_back(0);
+		samples.push_back((uint8_t)value);
+	} else {
+		samples[samples.size() - 2] = (uint8_t)value;
+	}
+}
+
+static bool readEvents(const char *path, std::vector<Event> &events) {
+	FILE *file = fopen(path, "r");
+	if (!file)
+		return false;
+	char line[128];
+	while (fgets(line, sizeof(line), file)) {
+		char *comment = strchr(line, '#');
+		if (comment)
+			*comment = '\0';
+		Event event = {0, "", 0, 0, 0, 0, 0};
+		int count = sscanf(line, "%u %15s %i %i %i %i", &event.timeMs, event.command, &event.arg0, &event.arg1,
+						   &event.arg2, &event.arg3);
+		if (count >= 2) {
+			event.argCount = count - 2;
+			events.push_back(event);
+		}
+	}
+	fclose(file);
+	return true;
+}
+
+static void writeLE(FILE *file, uint32_t value, uint8_t bytes) {
+	for (uint8_t i = 0; i < bytes; i++)
+		fputc((value >> (8 * i)) & 0xff, file);
+}
+
+// DAC values are 0-255 centred on 128, which is exactly 8-bit unsigned PCM
+static bool writeWav(const char *path) {
+	FILE *file = fopen(path, "wb");
+	if (!file)
+		return false;
+	fwrite("RIFF", 1, 4, file);
+	writeLE(file, 36 + samples.size(), 4);
+	fwrite("WAVEfmt ", 1, 8, file);
+	writeLE(file, 16, 4);			// Format chunk size
+	writeLE(file, 1, 2);			// PCM
+	writeLE(file, 2, 2);				// Stereo
+	writeLE(file, samplingRate, 4);		// Sample rate
+	writeLE(file, 2 * samplingRate, 4); // Byte rate
+	writeLE(file, 2, 2);				// Block align
+	writeLE(file, 8, 2);			// Bits per sample
+	fwrite("data", 1, 4, file);
+	writeLE(file, samples.size(), 4);
+	fwrite(samples.data(), 1, samples.size(), file);
+	fclose(file);
+	return true;
+}
+
+static void applyEvent(const Event &event, Timing &decodeTiming, Timing &midiTiming) {
+	if (!strcmp(event.command, "press") || !strcmp(event.command, "release")) {
+		uint8_t TX_Message[8] = {0};
+		TX_Message[0] = strcmp(event.command, "press") ? MSG_RELEASE : MSG_PRESS;
+		TX_Message[1] = event.arg0;
+		TX_Message[2] = event.arg1;
+		xQueueSend(msgInQ, TX_Message, 0);
+	} else if (!strcmp(event.command, "wave")) {
+		K1.setRotation(event.arg0);
+		selectedWaveform = K1.getRotation();
+	} else if (!strcmp(event.command, "volume")) {
+		K3.setRotation(event.arg0);
+		volume = K3.getRotation();
+	} else if (!strcmp(event.command, "envelope")) {
+		KA.setRotation(event.arg0);
+		KD.setRotation(event.arg1);
+		KS.setRotation(event.arg2);
+		KR.setRotation(event.arg3);
+	} else if (!strcmp(event.command, "stereo")) {
+		synth.setStereo(event.arg0);
+	} else if (!strcmp(event.command, "filter")) {
+		KT.setRotation(event.arg0);
+		KC.setRotation(event.arg1);
+		KQ.setRotation(event.arg2);
+	} else if (!strcmp(event.command, "seq")) {
+		KM.setRotation(event.arg0);
+		KB.setRotation(event.arg1);
+		KG.setRotation(event.arg2);
+	} else if (!strcmp(event.command, "fm")) {
+		KO.setRotation(event.arg0);
+		KI.setRotation(event.arg1);
+		KF.setRotation(event.arg2);
+	} else if (!strcmp(event.command, "midi")) {
+		const int args[4] = {event.arg0, event.arg1, event.arg2, event.arg3};
+		uint8_t bytes[4];
+		for (int i = 0; i < event.argCount; i++)
+			bytes[i] = args[i];
+		native::midiInject(bytes, event.argCount);
+		Clock::time_point start = Clock::now(); // Body of decodeTask(), woken by MIDI_RX_ISR()
+		decodePending();
+		midiTiming.add(std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start).count());
+	} else if (!strcmp(event.command, "joystick")) {
+		native::joystickX = event.arg0;
+		native::joystickY = event.arg1;
+	} else if (strcmp(event.command, "end")) {
+		fprintf(stderr, "Unknown command '%s' at %ums\n", event.command, event.timeMs);
+	}
+	publishControls(); // As scanKeysTask() does every scan, so knobs set from MIDI apply too
+	uint8_t RX_Message[8];
+	while (xQueueReceive(msgInQ, RX_Message, 0) == pdTRUE) { // Body of decodeTask()
+		Clock::time_point start = Clock::now();
+		decodeMessage(RX_Message);
+		decodeTiming.add(std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start).count());
+	}
+}
+
+int main(int argc, char **argv) {
+	if (argc != 3) {
+		fprintf(stderr, "Usage: %s <events.txt> <output.wav>\n", argv[0]);
+		return 1;
+	}
+	std::vector<Event> events;
+	if (!readEvents(argv[1], events)) {
+		fprintf(stderr, "Could not read %s\n", argv[1]);
+		return 1;
+	}
+	uint32_t endMs = events.empty() ? 0 : events.back().timeMs;
+
+	setup();
+	native::analogWriteHook = captureSample;
+	Timing renderTiming, decodeTiming, midiTiming;
+	size_t nextEvent = 0;
+	const uint64_t totalSamples = (uint64_t)endMs * samplingRate / 1000;
+	const uint64_t sampleNanos = 1000000000ULL / samplingRate;
+	samples.reserve(2 * totalSamples);
+
+	Clock::time_point wallStart = Clock::now();
+	for (uint64_t n = 0; n < totalSamples; n++) {
+		while (nextEvent < events.size() && (uint64_t)events[nextEvent].timeMs * samplingRate <= n * 1000)
+			applyEvent(events[nextEvent++], decodeTiming, midiTiming);
+		native::dacTick(); // One DMA transfer to the DAC, running DAC_DMA_ISR() at the end of each half
+		if (!bufferReady) { // renderTask() runs as soon as it is notified
+			Clock::time_point start = Clock::now();
+			renderPending();
+			renderTiming.add(std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start).count());
+		}
+		native::advanceNanos(sampleNanos);
+	}
+	double wallSeconds = std::chrono::duration<double>(Clock::now() - wallStart).count();
+	double audioSeconds = (double)totalSamples / samplingRate;
+
+	if (!writeWav(argv[2])) {
+		fprintf(stderr, "Could not write %s\n", argv[2]);
+		return 1;
+	}
+	printf("Rendered %.3fs of audio in %.3fs (%.0fx real time)\n", audioSeconds, wallSeconds,
+		   wallSeconds > 0 ? audioSeconds / wallSeconds : 0.0);
+	renderTiming.print("renderPending");
+	decodeTiming.print("decodeMessage");
+	midiTiming.print("decodePending");
+	printf("Block deadline   %9.3fus\n", blockSize * 1e6 / samplingRate);
+	printf("Underruns        %u\n", (unsigned)underrunCount);
+	printf("Parked           %ums in %u parks\n", (unsigned)(parkedTime + (audioParked ? millis() - parkedSince : 0)),
+		   (unsigned)parkCount);
+	return 0;
+}
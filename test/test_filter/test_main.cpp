@@ -0,0 +1,142 @@
+// Checks that the portable Filter::process() matches the Cortex-M4 DSP path bit for bit
+// The DSP path is compiled a second time from lib/filter/filter.cpp into namespace dsp, with the PKHBT, SMLALD and SSAT
+// intrinsics emulated as the Armv7-M architecture manual defines them, and both are run on the same blocks
+// pio test -e native -f test_filter
+#include <Arduino.h>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <firmware.h>
+#include <unity.h>
+
+// Top half of high shifted left by shift, with the bottom half of low
+static inline uint32_t __PKHBT(uint32_t low, uint32_t high, uint32_t shift) {
+	return (low & 0xFFFF) | ((high << shift) & 0xFFFF0000);
+}
+
+// Both signed 16 by 16-bit products, of the bottom halves and of the top halves, added to the 64-bit accumulator
+// with no intermediate rounding or saturation, so the sum of the products wraps only at 64 bits
+static inline uint64_t __SMLALD(uint32_t a, uint32_t b, uint64_t acc) {
+	const int64_t low = (int64_t)(int16_t)a * (int16_t)b;
+	const int64_t high = (int64_t)(int16_t)(a >> 16) * (int16_t)(b >> 16);
+	return acc + (uint64_t)low + (uint64_t)high;
+}
+
+// Signed saturation to a width of bits
+static inline int32_t __SSAT(int32_t value, uint32_t bits) {
+	const int32_t largest = (1 << (bits - 1)) - 1;
+	return value > largest ? largest : value < -largest - 1 ? -largest - 1 : value;
+}
+
+namespace dsp {
+#define __ARM_FEATURE_DSP 1
+#undef FILTER_H
+#include "../../lib/filter/filter.cpp"
+#undef __ARM_FEATURE_DSP
+} // namespace dsp
+
+constexpr Table<int32_t, filterCutoffs> cutoffCos = makeCutoffTable<filterCutoffs>(samplingRate, 80, 6, true);
+constexpr Table<int32_t, filterCutoffs> cutoffSin = makeCutoffTable<filterCutoffs>(samplingRate, 80, 6, false);
+constexpr Table<int32_t, filterResonances> resonanceQ = makeGeometricTable<filterResonances>(0.7071, 1.2);
+
+const uint32_t testBlocks = 40;
+const uint8_t testCutoffs[] = {0, filterCutoffs / 2, filterCutoffs - 1};
+const uint8_t testResonances[] = {0, filterResonances / 2, filterResonances - 1};
+
+static uint32_t seed;
+
+// 16-bit signed noise from a linear congruential generator, so every run sees the same blocks
+static int32_t noise() {
+	seed = seed * 1664525 + 1013904223;
+	return (int16_t)(seed >> 16);
+}
+
+// Random samples over the whole 16-bit range
+static void randomBlock(int32_t *block, uint32_t index) {
+	for (uint32_t i = 0; i < blockSize; i++)
+		block[i] = noise();
+}
+
+// Full scale square waves, changing period every block, which drive the resonant settings into saturation
+static void fullScaleBlock(int32_t *block, uint32_t index) {
+	const uint32_t period = 2 + index % 37;
+	for (uint32_t i = 0; i < blockSize; i++)
+		block[i] = (index * blockSize + i) % period < period / 2 ? 32767 : -32768;
+}
+
+// Run both paths over testBlocks blocks on each channel for every cutoff and resonance tested, and require the same
+// output, so any difference in the filter state also shows up in the blocks after it
+static void checkType(FilterType type, void (*fill)(int32_t *, uint32_t)) {
+	static int32_t portable[blockSize], reference[blockSize];
+	for (uint8_t cutoff : testCutoffs) {
+		for (uint8_t resonance : testResonances) {
+			Filter filter;
+			dsp::Filter dspFilter;
+			filter.setCoefficients(type, cutoffCos[cutoff], cutoffSin[cutoff], resonanceQ[resonance]);
+			dspFilter.setCoefficients((dsp::FilterType)type, cutoffCos[cutoff], cutoffSin[cutoff],
+									  resonanceQ[resonance]);
+			seed = 1;
+			for (uint32_t b = 0; b < testBlocks; b++) {
+				for (uint8_t channel = 0; channel < Filter::channels; channel++) {
+					fill(portable, b);
+					for (uint32_t i = 0; i < blockSize; i++)
+						reference[i] = portable[i];
+					filter.process(portable, blockSize, channel);
+					dspFilter.process(reference, blockSize, channel);
+					char message[64];
+					snprintf(message, sizeof(message), "cutoff %u resonance %u block %u channel %u", cutoff,
+							 resonance, (unsigned)b, channel);
+					TEST_ASSERT_EQUAL_INT32_ARRAY_MESSAGE(reference, portable, blockSize, message);
+				}
+			}
+		}
+	}
+}
+
+void setUp() {}
+
+void tearDown() {}
+
+// The emulation against sums worked out by hand, including ones where the two products together overflow 32 bits
+void test_smlald_emulation() {
+	TEST_ASSERT_EQUAL_UINT64(2 * 3 + 4 * 5 + 100, __SMLALD(4 << 16 | 2, 5 << 16 | 3, 100));
+	TEST_ASSERT_EQUAL_UINT64((uint64_t)-6 - 20, __SMLALD(0xFFFC0002, 0x0005FFFD, 0));
+	TEST_ASSERT_EQUAL_INT64(2LL * 32768 * 32768, (int64_t)__SMLALD(0x80008000, 0x80008000, 0));
+	TEST_ASSERT_EQUAL_INT64(-1 - 2LL * 32768 * 32767, (int64_t)__SMLALD(0x80008000, 0x7FFF7FFF, (uint64_t)-1));
+}
+
+void test_lowpass_random() {
+	checkType(FILTER_LOWPASS, randomBlock);
+}
+
+void test_lowpass_full_scale() {
+	checkType(FILTER_LOWPASS, fullScaleBlock);
+}
+
+void test_highpass_random() {
+	checkType(FILTER_HIGHPASS, randomBlock);
+}
+
+void test_highpass_full_scale() {
+	checkType(FILTER_HIGHPASS, fullScaleBlock);
+}
+
+void test_bandpass_random() {
+	checkType(FILTER_BANDPASS, randomBlock);
+}
+
+void test_bandpass_full_scale() {
+	checkType(FILTER_BANDPASS, fullScaleBlock);
+}
+
+int main(int argc, char **argv) {
+	UNITY_BEGIN();
+	RUN_TEST(test_smlald_emulation);
+	RUN_TEST(test_lowpass_random);
+	RUN_TEST(test_lowpass_full_scale);
+	RUN_TEST(test_highpass_random);
+	RUN_TEST(test_highpass_full_scale);
+	RUN_TEST(test_bandpass_random);
+	RUN_TEST(test_bandpass_full_scale);
+	return UNITY_END();
+}
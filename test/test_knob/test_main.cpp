@@ -0,0 +1,189 @@
+// Checks KnobBank's decoding of quadrature traces, as scanKeysTask() reads them from the knob rows every 1ms, and
+// Knob's acceleration and range changes
+// pio test -e native -f test_knob
+#include <cstdint>
+#include <knob>
+#include <unity.h>
+
+// One change on a knob's encoder, BA as in the key matrix, held until the next one
+struct Edge {
+	uint32_t time; // ms from the start of the trace
+	uint8_t state;
+};
+
+static uint32_t now; // ms, carried on from one trace to the next so the bank always sees time move forwards
+
+// Matrix bits of a knob's encoder, knob 3 lowest
+static uint32_t knobBits(uint8_t knob, uint8_t state) {
+	return (uint32_t)state << (12 + 2 * (KnobBank::numKnobs - 1 - knob));
+}
+
+// Scan a trace on one knob every 1ms up to its last edge, with the other knobs at rest, and return the detents it
+// turned
+static int play(KnobBank &bank, uint8_t knob, const Edge *trace, uint32_t edges) {
+	uint8_t state = trace[0].state;
+	uint32_t next = 0;
+	for (uint32_t time = 0; time <= trace[edges - 1].time; time++) {
+		while (next < edges && trace[next].time <= time)
+			state = trace[next++].state;
+		bank.update(knobBits(knob, state), now + time);
+	}
+	now += trace[edges - 1].time + 1;
+	return bank.takeSteps(knob);
+}
+
+#define PLAY(bank, knob, trace) play(bank, knob, trace, sizeof(trace) / sizeof(trace[0]))
+
+// Two detents clockwise at 100ms apart, 00 01 11 10 00
+const Edge clockwise[] = {{0, 0}, {30, 1}, {60, 3}, {130, 2}, {160, 0}};
+// Two detents anticlockwise, 00 10 11 01 00
+const Edge anticlockwise[] = {{0, 0}, {30, 2}, {60, 3}, {130, 1}, {160, 0}};
+// Clockwise with 10 missed between two scans, 11 straight to 00
+const Edge skippedClockwise[] = {{0, 0}, {30, 1}, {60, 3}, {160, 0}};
+// Anticlockwise with 01 missed, 11 straight to 00
+const Edge skippedAnticlockwise[] = {{0, 0}, {30, 2}, {60, 3}, {160, 0}};
+// One detent clockwise with contact A bouncing on the way out of 00 and on the way into 11
+const Edge bounce[] = {{0, 0}, {30, 1}, {31, 0}, {32, 1}, {33, 0}, {34, 1},
+					   {60, 3}, {61, 1}, {62, 3}, {63, 1}, {64, 3}};
+// Turned half way to the next detent and back, which is no detent at all
+const Edge rocked[] = {{0, 0}, {30, 1}, {60, 0}, {90, 2}, {120, 0}};
+
+void setUp() {
+	now = 1000;
+}
+
+void tearDown() {}
+
+void test_clockwise() {
+	KnobBank bank;
+	TEST_ASSERT_EQUAL_INT(2, PLAY(bank, 0, clockwise));
+}
+
+void test_anticlockwise() {
+	KnobBank bank;
+	TEST_ASSERT_EQUAL_INT(-2, PLAY(bank, 0, anticlockwise));
+}
+
+void test_every_knob_decoded_apart() {
+	for (uint8_t knob = 0; knob < KnobBank::numKnobs; knob++) {
+		KnobBank bank;
+		TEST_ASSERT_EQUAL_INT_MESSAGE(2, PLAY(bank, knob, clockwise), "clockwise");
+		TEST_ASSERT_EQUAL_INT_MESSAGE(-2, PLAY(bank, knob, anticlockwise), "anticlockwise");
+		for (uint8_t other = 0; other < KnobBank::numKnobs; other++) {
+			if (other != knob)
+				TEST_ASSERT_EQUAL_INT_MESSAGE(0, bank.takeSteps(other), "other knob");
+		}
+	}
+}
+
+// The missed state counts as two transitions in the last direction, so the turn is not lost
+void test_skipped_state_counts_two() {
+	KnobBank bank;
+	TEST_ASSERT_EQUAL_INT(2, PLAY(bank, 0, skippedClockwise));
+	TEST_ASSERT_EQUAL_INT(-2, PLAY(bank, 0, skippedAnticlockwise));
+}
+
+void test_contact_bounce() {
+	KnobBank bounced, rocking;
+	TEST_ASSERT_EQUAL_INT(1, PLAY(bounced, 0, bounce));
+	TEST_ASSERT_EQUAL_INT(0, PLAY(rocking, 0, rocked));
+}
+
+// Detents 100ms, 40ms and 10ms apart
+void test_acceleration_thresholds() {
+	const Edge slow[] = {{0, 0}, {50, 1}, {100, 3}, {150, 2}, {200, 0}};
+	const Edge medium[] = {{0, 0}, {20, 1}, {40, 3}, {60, 2}, {80, 0}};
+	const Edge fast[] = {{0, 0}, {5, 1}, {10, 3}, {15, 2}, {20, 0}};
+	KnobBank bank;
+	TEST_ASSERT_EQUAL_INT(2, PLAY(bank, 1, slow));
+	TEST_ASSERT_EQUAL_UINT8(1, bank.getAcceleration(1));
+	TEST_ASSERT_EQUAL_INT(2, PLAY(bank, 1, medium));
+	TEST_ASSERT_EQUAL_UINT8(2, bank.getAcceleration(1));
+	TEST_ASSERT_EQUAL_INT(2, PLAY(bank, 1, fast));
+	TEST_ASSERT_EQUAL_UINT8(4, bank.getAcceleration(1));
+	TEST_ASSERT_EQUAL_INT(2, PLAY(bank, 1, slow));
+	TEST_ASSERT_EQUAL_UINT8(1, bank.getAcceleration(1));
+}
+
+// Bounce within a detent is no detent, so it does not count as a fast turn
+void test_bounce_keeps_acceleration() {
+	KnobBank bank;
+	TEST_ASSERT_EQUAL_INT(2, PLAY(bank, 2, clockwise));
+	TEST_ASSERT_EQUAL_UINT8(1, bank.getAcceleration(2));
+	const Edge chatter[] = {{0, 0}, {1, 1}, {2, 0}, {3, 2}, {4, 0}};
+	TEST_ASSERT_EQUAL_INT(0, PLAY(bank, 2, chatter));
+	TEST_ASSERT_EQUAL_UINT8(1, bank.getAcceleration(2));
+}
+
+// Acceleration only applies to knobs with a range of accelerationRange or more, and the limits still hold
+void test_accelerated_turn() {
+	Knob narrow(0, Knob::accelerationRange - 1, 5), wide(0, Knob::accelerationRange, 5);
+	narrow.turn(1, 4);
+	wide.turn(1, 4);
+	TEST_ASSERT_EQUAL_INT(6, narrow.getRotation());
+	TEST_ASSERT_EQUAL_INT(9, wide.getRotation());
+	wide.turn(2, 4);
+	TEST_ASSERT_EQUAL_INT(Knob::accelerationRange, wide.getRotation());
+	wide.turn(-3, 2);
+	TEST_ASSERT_EQUAL_INT(6, wide.getRotation());
+	wide.turn(-2, 4);
+	TEST_ASSERT_EQUAL_INT(0, wide.getRotation());
+}
+
+// Gain of one volume step in 256ths, coarse over 0-5 and finer over 0-20, as volumeStep() in src/main.cpp
+const int coarseStep = 25, fineStep = 12;
+
+// Rotations are moved to the one nearest the same value in the new step, then held to the new limits
+void test_set_limits_rescales() {
+	Knob knob(0, 16, 8);
+	knob.setLimits(0, 20, 3, 2);
+	TEST_ASSERT_EQUAL_INT(12, knob.getRotation());
+	knob.setLimits(0, 16, 2, 4);
+	TEST_ASSERT_EQUAL_INT(6, knob.getRotation());
+	knob.setLimits(0, 5, 4, 8);
+	TEST_ASSERT_EQUAL_INT(3, knob.getRotation()); // 24 / 8
+	knob.setLimits(0, 5, 1, 1); // Unchanged limits leave the rotation alone
+	TEST_ASSERT_EQUAL_INT(3, knob.getRotation());
+	knob.setLimits(0, 20, 5, 2);
+	TEST_ASSERT_EQUAL_INT(8, knob.getRotation()); // 7.5 rounds up
+	knob.setLimits(10, 30, 1, 1);
+	TEST_ASSERT_EQUAL_INT(10, knob.getRotation());
+	knob.setLimits(0, 5, 30, 1);
+	TEST_ASSERT_EQUAL_INT(5, knob.getRotation());
+}
+
+// Switching the volume between its 0-5 and 0-20 ranges keeps the gain within half a step of the new range, up to its
+// top, and coarse settings come back unchanged from the finer range
+void test_volume_range_keeps_gain() {
+	for (int volume = 0; volume <= 5; volume++) {
+		Knob knob(0, 5, volume);
+		knob.setLimits(0, 20, coarseStep, fineStep);
+		TEST_ASSERT_INT_WITHIN_MESSAGE(fineStep / 2, volume * coarseStep, knob.getRotation() * fineStep, "to finer");
+		knob.setLimits(0, 5, fineStep, coarseStep);
+		TEST_ASSERT_EQUAL_INT_MESSAGE(volume, knob.getRotation(), "and back");
+	}
+	for (int volume = 0; volume <= 20; volume++) {
+		Knob knob(0, 20, volume);
+		knob.setLimits(0, 5, fineStep, coarseStep);
+		if (volume * fineStep <= 5 * coarseStep)
+			TEST_ASSERT_INT_WITHIN_MESSAGE(coarseStep / 2, volume * fineStep, knob.getRotation() * coarseStep,
+										   "to coarse");
+		else
+			TEST_ASSERT_EQUAL_INT_MESSAGE(5, knob.getRotation(), "to coarse, beyond its top");
+	}
+}
+
+int main(int argc, char **argv) {
+	UNITY_BEGIN();
+	RUN_TEST(test_clockwise);
+	RUN_TEST(test_anticlockwise);
+	RUN_TEST(test_every_knob_decoded_apart);
+	RUN_TEST(test_skipped_state_counts_two);
+	RUN_TEST(test_contact_bounce);
+	RUN_TEST(test_acceleration_thresholds);
+	RUN_TEST(test_bounce_keeps_acceleration);
+	RUN_TEST(test_accelerated_turn);
+	RUN_TEST(test_set_limits_rescales);
+	RUN_TEST(test_volume_range_keeps_gain);
+	return UNITY_END();
+}
@@ -0,0 +1,105 @@
+#!/usr/bin/env python3
+"""Generate the band-limited sawtooth, square and triangle wavetables used by lib/synth.
+
+Each waveform is built by additive synthesis, with one mip level per octave of phase step size. Level k is used for
+step sizes in [2^(21+k), 2^(22+k)), so it holds every harmonic below the Nyquist frequency of its highest note.
+Tables are signed 16-bit, with one extra guard sample so interpolation never has to wrap.
+The sine only has one harmonic, so it needs no mip levels and is generated at compile time by lib/tables instead.
+Additive synthesis of hundreds of harmonics is too slow for the compiler's constexpr evaluation.
+
+Run by PlatformIO before each build (extra_scripts = pre:tools/gen_wavetables.py), writing wavetables.h into the
+build directory, or standalone with: python tools/gen_wavetables.py <output directory>
+"""
+import math
+import os
+import sys
+
+TABLE_BITS = 9
+TABLE_SIZE = 1 << TABLE_BITS
+LEVELS = 10
+LOWEST_LEVEL_BITS = 21  # log2 of the smallest step size of level 0, C1 at 48kHz is 2^21.5
+HEADER = "wavetables.h"
+
+# Waveforms as Fourier series matching the phase and polarity of the naive versions:
+# sawtooth rises through zero at phase 0, square is high for the second half cycle, triangle starts at its minimum
+WAVEFORMS = {
+    "square": lambda n: (0.0, -4 / (math.pi * n)) if n % 2 else (0.0, 0.0),
+    "sawtooth": lambda n: (0.0, 2 / (math.pi * n) * (1 if n % 2 else -1)),
+    "triangle": lambda n: (-8 / (math.pi * n) ** 2, 0.0) if n % 2 else (0.0, 0.0),
+}
+
+
+def harmonics(level):
+    """Highest harmonic of the lowest note using a level that is still below Nyquist, limited by the table size."""
+    return min(1 << (31 - LOWEST_LEVEL_BITS - 1 - level), TABLE_SIZE // 2 - 1)
+
+
+def synthesise(series, count):
+    sine = [math.sin(2 * math.pi * i / TABLE_SIZE) for i in range(TABLE_SIZE)]
+    cosine = [math.cos(2 * math.pi * i / TABLE_SIZE) for i in range(TABLE_SIZE)]
+    table = [0.0] * TABLE_SIZE
+    for n in range(1, count + 1):
+        a, b = series(n)
+        if a == 0 and b == 0:
+            continue
+        for i in range(TABLE_SIZE):
+            j = (n * i) % TABLE_SIZE
+            table[i] += a * cosine[j] + b * sine[j]
+    return table
+
+
+def quantise(table, scale):
+    values = [max(-32768, min(32767, round(value * scale))) for value in table]
+    return values + values[:1]
+
+
+def format_table(values, indent):
+    lines = []
+    for i in range(0, len(values), 16):
+        lines.append(indent + ", ".join(str(value) for value in values[i:i + 16]) + ",")
+    return "\n".join(lines)
+
+
+def generate():
+    out = ["// Generated by tools/gen_wavetables.py, do not edit",
+           "#include <cstdint>",
+           "",
+           "#ifndef WAVETABLES_H",
+           "#define WAVETABLES_H",
+           "",
+           f"const uint32_t wavetableBits = {TABLE_BITS};",
+           f"const uint32_t wavetableLevels = {LEVELS};",
+           f"const uint32_t wavetableLowestLevelBits = {LOWEST_LEVEL_BITS};",
+           ""]
+    for name, series in WAVEFORMS.items():
+        levels = [synthesise(series, harmonics(level)) for level in range(LEVELS)]
+        # One scale for every level, so the Gibbs overshoot of level 0 fits and loudness does not change between octaves
+        scale = 32767 / max(max(abs(value) for value in table) for table in levels)
+        out.append(f"const int16_t {name}Tables[{LEVELS}][{TABLE_SIZE + 1}] = {{")
+        for level, table in enumerate(levels):
+            out.append(f"\t{{ // Level {level}, {harmonics(level)} harmonics")
+            out.append(format_table(quantise(table, scale), "\t\t"))
+            out.append("\t},")
+        out.append("};")
+        out.append("")
+    out.append("#endif")
+    return "\n".join(out) + "\n"
+
+
+def write_header(directory):
+    path = os.path.join(directory, HEADER)
+    script = os.path.abspath(__file__)
+    if os.path.exists(path) and os.path.getmtime(path) >= os.path.getmtime(script):
+        return  # Up to date
+    os.makedirs(directory, exist_ok=True)
+    with open(path, "w") as file:
+        file.write(generate())
+
+
+if __name__ == "__main__":
+    write_header(sys.argv[1] if len(sys.argv) > 1 else ".")
+else:
+    Import("env")  # noqa: F821, provided by PlatformIO
+    generated = os.path.join(env.subst("$BUILD_DIR"), "generated")  # noqa: F821
+    write_header(generated)
+    env.Append(CPPPATH=[generated])  # noqa: F821
@@ -0,0 +1,88 @@
+#!/usr/bin/env python3
+"""Decode the execution trace reports printed over Serial by firmware built with ENABLE_TRACE.
+
+Reads the serial log from a file or stdin, for example:
+    pio device monitor -e nucleo_l432kc_trace | python tools/trace_decode.py
+and prints, for each report window, the execution time statistics and CPU usage of each task and ISR,
+followed by a critical instant analysis using the worst case times measured so far.
+"""
+import argparse
+import math
+import sys
+
+# Minimum initiation interval of each traced function in seconds, matching the values in main.cpp and README.md
+INITIATION_INTERVALS = {
+    "DAC_DMA_ISR": 220 / 48000,
+    "CAN_RX_ISR": 0.7e-3,
+    "renderTask": 220 / 48000,
+    "scanKeysTask": 1e-3,
+    "decodeTask": 22.4e-3,
+    "displayUpdateTask": 50e-3,
+    "CAN_TX_ISR": 0.7e-3,
+    "CAN_TX_Task": 0.7e-3,
+}
+
+
+def microseconds(cycles, clock):
+    return cycles * 1e6 / clock
+
+
+def print_window(stats, window, dropped, clock, worst):
+    print(f"Window {window / clock * 1e3:.1f}ms, {dropped} events dropped")
+    print(f"{'Function':<18} {'Count':>7} {'Min us':>9} {'Avg us':>9} {'P99 us':>9} {'Max us':>9} {'CPU %':>7}")
+    total_usage = 0.0
+    for name, (count, minimum, average, p99, maximum, total) in stats.items():
+        usage = 100.0 * total / window if window else 0.0
+        total_usage += usage
+        print(f"{name:<18} {count:>7} {microseconds(minimum, clock):>9.2f} {microseconds(average, clock):>9.2f} "
+              f"{microseconds(p99, clock):>9.2f} {microseconds(maximum, clock):>9.2f} {usage:>7.2f}")
+        if count:
+            worst[name] = max(worst.get(name, 0.0), maximum / clock)
+    print(f"{'Total':<18} {'':>7} {'':>9} {'':>9} {'':>9} {'':>9} {total_usage:>7.2f}")
+
+
+def print_critical_instant(worst):
+    """Worst case latency of the lowest priority task, assuming every function is released at the same instant."""
+    if not worst:
+        return
+    longest = max(INITIATION_INTERVALS.values())
+    latency = 0.0
+    for name, interval in sorted(INITIATION_INTERVALS.items(), key=lambda item: item[1]):
+        if name not in worst:
+            continue
+        releases = math.ceil(longest / interval)
+        latency += releases * worst[name]
+        print(f"  {name:<18} {releases:>5} x {worst[name] * 1e6:>9.2f}us")
+    verdict = "meets" if latency <= longest else "MISSES"
+    print(f"Critical instant latency {latency * 1e3:.2f}ms, {verdict} the {longest * 1e3:.0f}ms deadline\n")
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("log", nargs="?", type=argparse.FileType("r"), default=sys.stdin,
+                        help="serial log to decode, defaults to stdin")
+    args = parser.parse_args()
+
+    clock = 80000000
+    stats = {}
+    worst = {}
+    for line in args.log:
+        fields = line.strip().split(",")
+        if len(fields) < 2 or fields[0] != "T":
+            continue  # Other Serial output
+        try:
+            if fields[1] == "clock":
+                clock = int(fields[2])
+                stats = {}
+            elif fields[1] == "window":
+                print_window(stats, int(fields[2]), int(fields[3]), clock, worst)
+                print_critical_instant(worst)
+                sys.stdout.flush()
+            else:
+                stats[fields[1]] = tuple(int(value) for value in fields[2:8])
+        except (IndexError, ValueError):
+            continue  # Line corrupted in transit
+
+
+if __name__ == "__main__":
+    main()
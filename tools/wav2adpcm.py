@@ -0,0 +1,203 @@
+#!/usr/bin/env python3
+"""Convert the WAV files in samples/ into the IMA-ADPCM flash image played by the SAMPLE waveform of lib/synth.
+
+Each WAV becomes one AdpcmSample (lib/adpcm), 4 bits per sample, so a second at 24kHz takes 12KB of flash and no RAM.
+WAVs may be 8 or 16-bit PCM at any rate, stereo is mixed down to mono. The root note and sustain loop are read from
+the WAV's smpl chunk, as written by most sample editors. Without one the root note is taken from a trailing _<MIDI note>
+in the file name, such as piano_60.wav for C4, and the sample plays once. Each note plays the sample whose root is
+nearest below it, so a multi-sampled instrument is a set of WAVs with different roots.
+Without any WAVs a synthesised electric piano is used, so the firmware always has a sample to play.
+
+Codes are chosen by trying all 16 against the decoder, rather than by the usual successive approximation, as the
+conversion is offline. The decoder state at the loop start is stored, so the loop goes round without a click.
+
+Run by PlatformIO before each build (extra_scripts = pre:tools/wav2adpcm.py), writing samples.h into the build
+directory, or standalone with: python tools/wav2adpcm.py <output directory> [WAV files]
+"""
+import glob
+import math
+import os
+import random
+import re
+import struct
+import sys
+import wave
+
+SAMPLING_RATE = 48000  # Must match samplingRate in include/firmware.h, as the root step sizes are generated for it
+HEADER = "samples.h"
+SAMPLES_DIR = os.path.join(os.path.dirname(os.path.abspath(__file__)), "..", "samples")
+
+STEP_TABLE = [
+    7, 8, 9, 10, 11, 12, 13, 14, 16, 17, 19, 21, 23, 25, 28, 31, 34, 37, 41, 45, 50, 55, 60, 66, 73, 80, 88, 97, 107,
+    118, 130, 143, 157, 173, 190, 209, 230, 253, 279, 307, 337, 371, 408, 449, 494, 544, 598, 658, 724, 796, 876, 963,
+    1060, 1166, 1282, 1411, 1552, 1707, 1878, 2066, 2272, 2499, 2749, 3024, 3327, 3660, 4026, 4428, 4871, 5358, 5894,
+    6484, 7132, 7845, 8630, 9493, 10442, 11487, 12635, 13899, 15289, 16818, 18500, 20350, 22385, 24623, 27086, 29794,
+    32767]
+INDEX_TABLE = [-1, -1, -1, -1, 2, 4, 6, 8, -1, -1, -1, -1, 2, 4, 6, 8]
+
+
+def decode_step(code, predictor, index):
+    """One sample of the decoder in lib/adpcm/adpcm.cpp, returning the new predictor and step index."""
+    step = STEP_TABLE[index]
+    difference = step >> 3
+    if code & 4:
+        difference += step
+    if code & 2:
+        difference += step >> 1
+    if code & 1:
+        difference += step >> 2
+    predictor += -difference if code & 8 else difference
+    predictor = max(-32768, min(32767, predictor))
+    index = max(0, min(88, index + INDEX_TABLE[code]))
+    return predictor, index
+
+
+def encode(samples, loop_start):
+    """Returns the 4-bit codes and the decoder state on reaching loop_start."""
+    predictor, index = 0, 0
+    codes = []
+    loop_state = (0, 0)
+    for position, target in enumerate(samples):
+        if position == loop_start:
+            loop_state = (predictor, index)
+        best = min(range(16), key=lambda code: abs(decode_step(code, predictor, index)[0] - target))
+        predictor, index = decode_step(best, predictor, index)
+        codes.append(best)
+    return codes, loop_state
+
+
+def midi_frequency(note):
+    return 440.0 * 2 ** ((note - 69) / 12)
+
+
+def read_wav(path):
+    """Returns the mono samples, rate, root frequency and loop (start, end), or None for no loop."""
+    with wave.open(path, "rb") as file:
+        channels, width, rate = file.getnchannels(), file.getsampwidth(), file.getframerate()
+        frames = file.readframes(file.getnframes())
+    if width == 1:
+        values = [(byte - 128) << 8 for byte in frames]
+    elif width == 2:
+        values = list(struct.unpack(f"<{len(frames) // 2}h", frames))
+    else:
+        raise ValueError(f"{path}: only 8 and 16-bit PCM are supported")
+    samples = [sum(values[i:i + channels]) // channels for i in range(0, len(values), channels)]
+    root, loop = read_smpl(path)
+    if root is None:
+        match = re.search(r"_(\d+)$", os.path.splitext(os.path.basename(path))[0])
+        root = int(match.group(1)) if match else 60
+    return samples, rate, midi_frequency(root), loop
+
+
+def read_smpl(path):
+    """Root MIDI note and first loop from a smpl chunk, each None if missing."""
+    with open(path, "rb") as file:
+        data = file.read()
+    offset = 12
+    while offset + 8 <= len(data):
+        chunk, size = struct.unpack("<4sI", data[offset:offset + 8])
+        body = data[offset + 8:offset + 8 + size]
+        if chunk == b"smpl" and len(body) >= 36:
+            root = struct.unpack("<I", body[12:16])[0]
+            loops = struct.unpack("<I", body[28:32])[0]
+            loop = None
+            if loops and len(body) >= 60:
+                start, end = struct.unpack("<II", body[44:52])
+                loop = (start, end + 1)  # smpl loop ends are inclusive
+            return root, loop
+        offset += 8 + size + (size & 1)
+    return None, None
+
+
+def electric_piano():
+    """Decaying harmonics over a steady tone, with a short hammer noise, looped over a whole number of cycles."""
+    rate, loop_length, loop_cycles = 24000, 367, 4  # 261.58Hz, within a cent of C4, with an exact loop
+    frequency = loop_cycles * rate / loop_length
+    length = 18000
+    noise = random.Random(1)
+    samples = []
+    for n in range(length):
+        t = n / rate
+        value = 0.0
+        for harmonic in range(1, 9):
+            steady = 0.5 / harmonic ** 1.5
+            strike = 1.0 / harmonic
+            level = steady + (strike - steady) * math.exp(-t * harmonic / 0.12)
+            value += level * math.sin(2 * math.pi * frequency * harmonic * t)
+        if t < 0.005:
+            value += (noise.random() - 0.5) * (1 - t / 0.005)
+        samples.append(value)
+    scale = 0.9 * 32767 / max(abs(value) for value in samples)
+    samples = [round(value * scale) for value in samples]
+    return samples, rate, frequency, (length - loop_length * 4, length)
+
+
+def sample_entry(name, samples, rate, frequency, loop):
+    loop_start, loop_end = loop if loop else (0, 0)
+    codes, (loop_predictor, loop_index) = encode(samples, loop_start)
+    if len(codes) & 1:
+        codes.append(0)
+    data = [codes[i] | codes[i + 1] << 4 for i in range(0, len(codes), 2)]
+    return {
+        "name": name,
+        "data": data,
+        "length": len(samples),
+        "loop": (loop_start, loop_end, loop_predictor, loop_index),
+        "rootStep": round(frequency * 2 ** 32 / SAMPLING_RATE),
+        "pitchScale": round(rate / frequency * 65536),
+    }
+
+
+def generate(paths):
+    entries = []
+    for path in paths:
+        samples, rate, frequency, loop = read_wav(path)
+        entries.append(sample_entry(os.path.basename(path), samples, rate, frequency, loop))
+    if not entries:
+        entries.append(sample_entry("synthesised electric piano", *electric_piano()))
+    entries.sort(key=lambda entry: entry["rootStep"])  # Lowest root first, as lib/synth searches them in order
+    out = ["// Generated by tools/wav2adpcm.py, do not edit",
+           "#include <adpcm>",
+           "#include <cstdint>",
+           "",
+           "#ifndef SAMPLES_H",
+           "#define SAMPLES_H",
+           ""]
+    for number, entry in enumerate(entries):
+        out.append(f"const uint8_t sampleData{number}[{len(entry['data'])}] = {{ // {entry['name']}")
+        for i in range(0, len(entry["data"]), 24):
+            out.append("\t" + ", ".join(str(byte) for byte in entry["data"][i:i + 24]) + ",")
+        out.append("};")
+        out.append("")
+    out.append(f"const uint8_t sampleCount = {len(entries)};")
+    out.append("const AdpcmSample sampleBank[sampleCount] = {")
+    for number, entry in enumerate(entries):
+        loop_start, loop_end, loop_predictor, loop_index = entry["loop"]
+        out.append(f"\t{{sampleData{number}, {entry['length']}, {loop_start}, {loop_end}, {loop_predictor}, "
+                   f"{loop_index}, {entry['rootStep']}, {entry['pitchScale']}}},")
+    out.append("};")
+    out.append("")
+    out.append("#endif")
+    return "\n".join(out) + "\n"
+
+
+def write_header(directory, paths):
+    path = os.path.join(directory, HEADER)
+    sources = [os.path.abspath(__file__)] + paths
+    if os.path.isdir(SAMPLES_DIR):
+        sources.append(SAMPLES_DIR)  # Its time changes when a WAV is added or removed
+    if os.path.exists(path) and os.path.getmtime(path) >= max(os.path.getmtime(source) for source in sources):
+        return  # Up to date
+    os.makedirs(directory, exist_ok=True)
+    with open(path, "w") as file:
+        file.write(generate(paths))
+
+
+if __name__ == "__main__":
+    write_header(sys.argv[1] if len(sys.argv) > 1 else ".",
+                 sys.argv[2:] or sorted(glob.glob(os.path.join(SAMPLES_DIR, "*.wav"))))
+else:
+    Import("env")  # noqa: F821, provided by PlatformIO
+    generated = os.path.join(env.subst("$BUILD_DIR"), "generated")  # noqa: F821
+    write_header(generated, sorted(glob.glob(os.path.join(SAMPLES_DIR, "*.wav"))))
+    env.Append(CPPPATH=[generated])  # noqa: F821